@@ -0,0 +1,256 @@
+/*
+ * Checks that the heatmap engine's per-frame path is allocation free.
+ *
+ * Replays a detection log (or a synthetic crowd if none is given) through
+ * the engine the way infer_sink_pad_buffer_probe drives it: accumulate every
+ * frame, refresh the background and render every 30 frames. malloc and
+ * operator new are hooked, and after a warm-up period every frame must go
+ * through without a single heap allocation. Exits non-zero otherwise.
+ * Each frame is also queued for the detection log (written to /dev/null),
+ * flushed every RENDER_INTERVAL frames outside the measurement, as the
+ * app's main loop does.
+ * The person count of every frame goes to the occupancy stats, with short
+ * intervals so the ring is recycled many times. Those updates are checked
+ * from the first frame on: the tracker is allocated when the source is
+ * added, never by an update.
+ * The canvas geometry, accumulator and stamp come from the [geometry]
+ * section of heatmap_config.txt, and detections are weighted and
+ * de-duplicated per its [weighting] section, if it is in the working
+ * directory, like in the app.
+ *
+ * Usage: alloc_check [detections.log]
+ */
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+
+#include "bench_common.h"
+#include "../heatmap_config.h"
+#include "../heatmap_engine.h"
+#include "../occupancy_stats.h"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#define RENDER_INTERVAL 30
+#define WARMUP_FRAMES (2 * RENDER_INTERVAL)
+#define SYNTHETIC_FRAMES 3000
+#define SYNTHETIC_PEOPLE 40
+#define CONFIG_FILE "heatmap_config.txt"
+#define RECORD_MAX_DETECTIONS (RENDER_INTERVAL * 1024)
+#define FRAME_US (1000000 / 30)
+#define OCCUPANCY_INTERVAL_SEC 1
+#define OCCUPANCY_INTERVALS 4
+
+static std::atomic<bool> counting (false);
+static std::atomic<unsigned long> allocations (0);
+
+static inline void
+count_allocation (void)
+{
+  if (counting.load (std::memory_order_relaxed))
+    allocations.fetch_add (1, std::memory_order_relaxed);
+}
+
+/* glibc's real allocator entry points. */
+extern "C" {
+void *__libc_malloc (size_t size);
+void *__libc_calloc (size_t n, size_t size);
+void *__libc_realloc (void *ptr, size_t size);
+void *__libc_memalign (size_t alignment, size_t size);
+void __libc_free (void *ptr);
+
+void *
+malloc (size_t size)
+{
+  count_allocation ();
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n, size_t size)
+{
+  count_allocation ();
+  return __libc_calloc (n, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+  count_allocation ();
+  return __libc_realloc (ptr, size);
+}
+
+void *
+memalign (size_t alignment, size_t size)
+{
+  count_allocation ();
+  return __libc_memalign (alignment, size);
+}
+
+void *
+aligned_alloc (size_t alignment, size_t size)
+{
+  count_allocation ();
+  return __libc_memalign (alignment, size);
+}
+
+int
+posix_memalign (void **ptr, size_t alignment, size_t size)
+{
+  count_allocation ();
+  *ptr = __libc_memalign (alignment, size);
+  return *ptr ? 0 : ENOMEM;
+}
+
+void
+free (void *ptr)
+{
+  __libc_free (ptr);
+}
+}
+
+void *
+operator new (size_t size)
+{
+  void *ptr = malloc (size ? size : 1);
+  if (!ptr)
+    throw std::bad_alloc ();
+  return ptr;
+}
+
+void *
+operator new[] (size_t size)
+{
+  return operator new (size);
+}
+
+void
+operator delete (void *ptr) noexcept
+{
+  free (ptr);
+}
+
+void
+operator delete[] (void *ptr) noexcept
+{
+  free (ptr);
+}
+
+void
+operator delete (void *ptr, size_t) noexcept
+{
+  free (ptr);
+}
+
+void
+operator delete[] (void *ptr, size_t) noexcept
+{
+  free (ptr);
+}
+
+int
+main (int argc, char *argv[])
+{
+  HeatmapConfig config;
+  heatmap_config_default (&config);
+  if (access (CONFIG_FILE, R_OK) == 0 &&
+      !heatmap_config_load (CONFIG_FILE, &config))
+    return -1;
+  if (!heatmap_engine_init_geometry (&config.geometry))
+    return -1;
+  heatmap_engine_set_weighting (&config.weighting);
+  int width = config.geometry.width, height = config.geometry.height;
+  printf ("geometry %dx%d, kernels %s\n", width, height,
+      heatmap_engine_kernel_name ());
+
+  HeatmapReplay replay;
+  if (argc > 1) {
+    if (!heatmap_replay_load (argv[1], &replay))
+      return -1;
+  } else {
+    CrowdParams params;
+    params.pattern = CROWD_CORRIDORS;
+    params.width = width;
+    params.height = height;
+    params.people = SYNTHETIC_PEOPLE;
+    params.frames = SYNTHETIC_FRAMES;
+    params.source_id = 0;
+    params.seed = 7;
+    crowd_generate (params, &replay);
+  }
+  if (replay.frames.size () <= WARMUP_FRAMES) {
+    fprintf (stderr, "need more than %d frames\n", WARMUP_FRAMES);
+    return -1;
+  }
+
+  occupancy_init (OCCUPANCY_INTERVAL_SEC, OCCUPANCY_INTERVALS);
+  for (const HeatmapReplayFrame &frame : replay.frames) {
+    heatmap_engine_get_source (frame.source_id);
+    occupancy_add_source (frame.source_id);
+  }
+
+  HeatmapRecorder *recorder = heatmap_recorder_open ("/dev/null",
+      RENDER_INTERVAL, RECORD_MAX_DETECTIONS);
+  if (!recorder)
+    return -1;
+
+  /* Stand-in for the BGRA surface the probe maps every frame. */
+  cv::Mat frame_bgra (height, width, CV_8UC4, cv::Scalar (40, 80, 120, 255));
+  HeatmapRenderParams params;
+  params.mode = HEATMAP_RENDER_OVERLAY;
+  params.colormap = cv::COLORMAP_JET;
+  params.alpha = 0.75;
+  params.window = cv::Rect ();
+
+  unsigned long worst = 0;
+  long dirty_frames = 0;
+  long measured = 0;
+  for (size_t i = 0; i < replay.frames.size (); i++) {
+    const HeatmapReplayFrame &frame = replay.frames[i];
+    HeatmapSource *src = heatmap_engine_get_source (frame.source_id);
+    bool measure = i >= WARMUP_FRAMES;
+
+    allocations = 0;
+    counting = true;
+    occupancy_update (frame.source_id, frame.count,
+        (int64_t) frame.frame_number * FRAME_US);
+    counting = measure;
+    heatmap_source_accumulate (src, replay.dets.data () + frame.first,
+        frame.count);
+    heatmap_recorder_add (recorder, frame.frame_number, frame.source_id,
+        replay.dets.data () + frame.first, frame.count);
+    if (frame.frame_number % RENDER_INTERVAL == 0) {
+      heatmap_source_update_background (src, frame_bgra, cv::COLOR_RGBA2RGB);
+      heatmap_source_render (src, params);
+    }
+    counting = false;
+    if (i % RENDER_INTERVAL == RENDER_INTERVAL - 1)
+      heatmap_recorder_flush (recorder);
+
+    if (measure || allocations) {
+      measured += measure;
+      if (allocations) {
+        dirty_frames++;
+        if (allocations > worst)
+          worst = allocations;
+      }
+    }
+  }
+
+  heatmap_recorder_close (recorder, NULL);
+
+  printf ("frames=%zu warmup=%d measured=%ld frames_with_allocations=%ld "
+      "max_allocations_per_frame=%lu\n", replay.frames.size (), WARMUP_FRAMES,
+      measured, dirty_frames, worst);
+  if (dirty_frames) {
+    printf ("FAIL: frames allocated on the per-frame path\n");
+    return 1;
+  }
+  printf ("PASS: no heap allocations after warm-up\n");
+  return 0;
+}
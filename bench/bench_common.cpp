@@ -0,0 +1,277 @@
+/*
+ * Shared helpers for the bench/ tools. See bench_common.h.
+ */
+
+#include "bench_common.h"
+
+#include <linux/perf_event.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <random>
+#include <vector>
+
+using namespace std;
+
+#define NUM_QUEUES 4
+#define QUEUE_SPACING 25.0f
+#define NUM_CORRIDORS 3
+
+static const char *pattern_names[CROWD_NUM_PATTERNS] = {
+  "uniform", "queues", "corridors",
+};
+
+const char *
+crowd_pattern_name (CrowdPattern pattern)
+{
+  return pattern_names[pattern];
+}
+
+bool
+crowd_pattern_parse (const char *name, CrowdPattern *pattern)
+{
+  for (int i = 0; i < CROWD_NUM_PATTERNS; i++) {
+    if (strcmp (name, pattern_names[i]) == 0) {
+      *pattern = (CrowdPattern) i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Box for a person whose feet are at (x, y); people further up the frame
+ * are further from the camera and smaller. */
+static HeatmapDetection
+person_at (const CrowdParams &params, float x, float y, float confidence)
+{
+  HeatmapDetection det;
+  det.height = 60.0f + 100.0f * y / params.height;
+  det.width = det.height / 3;
+  det.left = x - det.width / 2;
+  det.top = y - det.height;
+  det.class_id = HEATMAP_CLASS_ID_PERSON;
+  det.confidence = confidence;
+  return det;
+}
+
+void
+crowd_generate (const CrowdParams &params, HeatmapReplay *replay)
+{
+  mt19937 rng (params.seed);
+  uniform_real_distribution<float> unit (0.0f, 1.0f);
+  normal_distribution<float> jitter (0.0f, 3.0f);
+  normal_distribution<float> lateral (0.0f, 15.0f);
+  const float w = (float) params.width;
+  const float h = (float) params.height;
+
+  /* Corridor end points, as fractions of the frame. */
+  static const float corridors[NUM_CORRIDORS][4] = {
+    { 0.0f, 0.35f, 1.0f, 0.35f },
+    { 0.0f, 0.75f, 1.0f, 0.70f },
+    { 0.1f, 1.0f, 0.9f, 0.2f },
+  };
+
+  /* Per-person state: corridor progress and speed. */
+  vector<float> progress (params.people), speed (params.people),
+      offset (params.people);
+  for (int i = 0; i < params.people; i++) {
+    progress[i] = unit (rng);
+    speed[i] = 0.002f + 0.004f * unit (rng);
+    offset[i] = lateral (rng);
+  }
+
+  const int others = params.people / 10;
+  vector<HeatmapDetection> dets;
+  dets.reserve (params.people + others);
+  for (long f = 0; f < params.frames; f++) {
+    dets.clear ();
+    for (int i = 0; i < params.people; i++) {
+      float confidence = 0.1f + 0.9f * unit (rng);
+      float x, y;
+      switch (params.pattern) {
+        case CROWD_QUEUES: {
+          int queue = i % NUM_QUEUES;
+          int slot = i / NUM_QUEUES;
+          /* Long queues fold back into a second column. */
+          int per_column = (int) (0.75f * h / QUEUE_SPACING);
+          x = w * (queue + 1) / (NUM_QUEUES + 1) +
+              (slot / per_column) * 30.0f + jitter (rng);
+          y = 0.85f * h - (slot % per_column) * QUEUE_SPACING + jitter (rng);
+          break;
+        }
+        case CROWD_CORRIDORS: {
+          const float *c = corridors[i % NUM_CORRIDORS];
+          progress[i] += speed[i];
+          if (progress[i] >= 1.0f)
+            progress[i] -= 1.0f;
+          float dx = (c[2] - c[0]) * w, dy = (c[3] - c[1]) * h;
+          float len = sqrtf (dx * dx + dy * dy);
+          x = c[0] * w + progress[i] * dx - dy / len * offset[i];
+          y = c[1] * h + progress[i] * dy + dx / len * offset[i];
+          break;
+        }
+        default:
+          x = w * unit (rng);
+          y = h * unit (rng);
+          break;
+      }
+      dets.push_back (person_at (params, x, y, confidence));
+    }
+    for (int i = 0; i < others; i++) {
+      HeatmapDetection det = person_at (params, w * unit (rng), h * unit (rng),
+          0.1f + 0.9f * unit (rng));
+      det.class_id = HEATMAP_CLASS_ID_PERSON + 1;
+      dets.push_back (det);
+    }
+    heatmap_replay_append (replay, f, params.source_id, dets.data (),
+        dets.size ());
+  }
+}
+
+void
+crowd_add_detector_noise (const HeatmapReplay &clean, int width, int height,
+    float duplicate_rate, float false_positive_rate, unsigned int seed,
+    HeatmapReplay *noisy)
+{
+  mt19937 rng (seed);
+  uniform_real_distribution<float> unit (0.0f, 1.0f);
+  normal_distribution<float> shift (0.0f, 2.0f);
+
+  vector<HeatmapDetection> dets;
+  for (const HeatmapReplayFrame &frame : clean.frames) {
+    dets.clear ();
+    int persons = 0;
+    for (size_t i = 0; i < frame.count; i++) {
+      const HeatmapDetection &det = clean.dets[frame.first + i];
+      dets.push_back (det);
+      if (det.class_id != HEATMAP_CLASS_ID_PERSON)
+        continue;
+      persons++;
+      if (unit (rng) >= duplicate_rate)
+        continue;
+      int extra = unit (rng) < 0.5f ? 1 : 2;
+      for (int k = 0; k < extra; k++) {
+        HeatmapDetection dup = det;
+        float scale = 0.9f + 0.2f * unit (rng);
+        dup.width *= scale;
+        dup.height *= scale;
+        dup.left = det.left + (det.width - dup.width) / 2 + shift (rng);
+        dup.top = det.top + (det.height - dup.height) + shift (rng);
+        dup.confidence = det.confidence * (0.3f + 0.6f * unit (rng));
+        dets.push_back (dup);
+      }
+    }
+
+    float expected = false_positive_rate * persons;
+    int spurious = (int) expected + (unit (rng) < expected - (int) expected);
+    for (int i = 0; i < spurious; i++) {
+      HeatmapDetection det;
+      det.height = 40.0f + 80.0f * unit (rng);
+      det.width = det.height / 3;
+      det.left = (width - det.width) * unit (rng);
+      det.top = (height - det.height) * unit (rng);
+      det.class_id = HEATMAP_CLASS_ID_PERSON;
+      det.confidence = 0.1f + 0.2f * unit (rng);
+      dets.push_back (det);
+    }
+    heatmap_replay_append (noisy, frame.frame_number, frame.source_id,
+        dets.data (), dets.size ());
+  }
+}
+
+double
+bench_now_ms (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+long
+bench_peak_rss_kb (void)
+{
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+long
+bench_current_rss_kb (void)
+{
+  FILE *fp = fopen ("/proc/self/statm", "r");
+  if (!fp)
+    return -1;
+  long size, resident;
+  int n = fscanf (fp, "%ld %ld", &size, &resident);
+  fclose (fp);
+  if (n != 2)
+    return -1;
+  return resident * (sysconf (_SC_PAGESIZE) / 1024);
+}
+
+static int
+perf_open_counter (uint64_t config, int group_fd)
+{
+  struct perf_event_attr attr;
+  memset (&attr, 0, sizeof (attr));
+  attr.size = sizeof (attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = group_fd < 0;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int) syscall (__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+void
+bench_perf_open (BenchPerfCounters *counters)
+{
+  counters->fd_refs = perf_open_counter (PERF_COUNT_HW_CACHE_REFERENCES, -1);
+  counters->fd_misses = counters->fd_refs < 0 ? -1 :
+      perf_open_counter (PERF_COUNT_HW_CACHE_MISSES, counters->fd_refs);
+  counters->available = counters->fd_refs >= 0 && counters->fd_misses >= 0;
+  if (!counters->available)
+    bench_perf_close (counters);
+}
+
+void
+bench_perf_start (BenchPerfCounters *counters)
+{
+  if (!counters->available)
+    return;
+  ioctl (counters->fd_refs, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl (counters->fd_refs, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void
+bench_perf_stop (BenchPerfCounters *counters, uint64_t *misses,
+    uint64_t *refs)
+{
+  *misses = 0;
+  *refs = 0;
+  if (!counters->available)
+    return;
+  ioctl (counters->fd_refs, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  if (read (counters->fd_misses, misses, sizeof (*misses)) != sizeof (*misses))
+    *misses = 0;
+  if (read (counters->fd_refs, refs, sizeof (*refs)) != sizeof (*refs))
+    *refs = 0;
+}
+
+void
+bench_perf_close (BenchPerfCounters *counters)
+{
+  if (counters->fd_misses >= 0)
+    close (counters->fd_misses);
+  if (counters->fd_refs >= 0)
+    close (counters->fd_refs);
+  counters->fd_misses = -1;
+  counters->fd_refs = -1;
+  counters->available = false;
+}
@@ -0,0 +1,77 @@
+/*
+ * Shared helpers for the bench/ tools: synthetic crowd generators, timing,
+ * peak RSS and hardware cache counters.
+ */
+
+#ifndef __BENCH_COMMON_H__
+#define __BENCH_COMMON_H__
+
+#include <stdint.h>
+
+#include "../heatmap_replay.h"
+
+enum CrowdPattern {
+  /* People spread evenly over the whole frame. */
+  CROWD_UNIFORM,
+  /* Tight lines of people standing at a few checkout-style queues. */
+  CROWD_QUEUES,
+  /* People walking along a few corridors and wrapping at the frame edge. */
+  CROWD_CORRIDORS,
+  CROWD_NUM_PATTERNS,
+};
+
+struct CrowdParams {
+  CrowdPattern pattern;
+  int width;
+  int height;
+  /* People in frame, 1..500 in the standard suite. */
+  int people;
+  long frames;
+  unsigned int source_id;
+  unsigned int seed;
+};
+
+const char *crowd_pattern_name (CrowdPattern pattern);
+
+/* Returns false if name is not a pattern name. */
+bool crowd_pattern_parse (const char *name, CrowdPattern *pattern);
+
+/* Appends params.frames frames of synthetic detections to replay. About one
+ * in ten detections is a non-person class and confidences are spread over
+ * the detector's range, like raw nvinfer output. */
+void crowd_generate (const CrowdParams &params, HeatmapReplay *replay);
+
+/* Copies clean into noisy, adding the artefacts of a low clustering
+ * threshold: each person detection gets, with probability duplicate_rate,
+ * one or two extra boxes a few pixels off at lower confidence, and each
+ * frame gets false_positive_rate * persons spurious low-confidence person
+ * boxes at random places. */
+void crowd_add_detector_noise (const HeatmapReplay &clean, int width,
+    int height, float duplicate_rate, float false_positive_rate,
+    unsigned int seed, HeatmapReplay *noisy);
+
+/* Monotonic clock in milliseconds. */
+double bench_now_ms (void);
+
+/* Peak resident set size of the process so far, in KiB. */
+long bench_peak_rss_kb (void);
+
+/* Current resident set size of the process, in KiB; -1 if unknown. */
+long bench_current_rss_kb (void);
+
+/* Hardware cache-miss / cache-reference counters for the calling thread,
+ * via perf_event_open. Unavailable counters (no PMU, perf_event_paranoid,
+ * containers) leave available false and read as zero. */
+struct BenchPerfCounters {
+  bool available;
+  int fd_misses;
+  int fd_refs;
+};
+
+void bench_perf_open (BenchPerfCounters *counters);
+void bench_perf_start (BenchPerfCounters *counters);
+void bench_perf_stop (BenchPerfCounters *counters, uint64_t *misses,
+    uint64_t *refs);
+void bench_perf_close (BenchPerfCounters *counters);
+
+#endif
@@ -0,0 +1,348 @@
+/*
+ * Benchmark of period comparison over persisted snapshots.
+ *
+ * Builds 16 cameras x 30 days of daily snapshots from synthetic crowds in a
+ * temporary directory, on int32 canvases as the app requires; half the
+ * cameras change layout halfway through. Every camera also has someone
+ * standing at one spot all day, which takes that pixel past what a uint16
+ * canvas holds within days. Then times, per camera and for all cameras at
+ * once, comparing the first and last week and the two halves of the month:
+ * snapshot loading, the fused diff/ratio kernel against the same maps built
+ * from separate OpenCV calls, and region extraction. Writes JSON, and fails
+ * unless every period shows exactly what was stamped at the busy spot.
+ *
+ * Usage: compare_bench [-o results.json] [-c cameras] [-d days]
+ *                      [-f frames_per_day] [-k] [-l label]
+ *   -k keeps the snapshot directory instead of deleting it.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_common.h"
+#include "../heatmap_compare.h"
+#include "../heatmap_engine.h"
+#include "../heatmap_snapshot.h"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#define WIDTH 1280
+#define HEIGHT 780
+#define PEOPLE 30
+#define DAY_SEC 86400
+#define BASE_TIME 1700000000
+#define KERNEL_REPEATS 5
+/* Frames a day with a person at (HOT_SPOT_X, HOT_SPOT_Y); at the default
+ * stamp weight the pixel passes 65535 on the fifth day. */
+#define HOT_SPOT_FRAMES 3000
+#define HOT_SPOT_X (WIDTH / 4)
+#define HOT_SPOT_Y (HEIGHT / 2)
+
+struct Timing {
+  double load_ms;
+  double kernel_ms;
+  double unfused_ms;
+  double regions_ms;
+  size_t regions;
+};
+
+struct PeriodResult {
+  const char *name;
+  int a_from, a_to, b_from, b_to;
+  /* Per-camera means. */
+  Timing mean;
+  /* Every camera, end to end, one thread and all cores. */
+  double all_serial_ms;
+  double all_parallel_ms;
+  /* Cameras whose busy spot shows other than what was stamped there. */
+  int hot_spot_errors;
+};
+
+/* diff and ratio the way one would write them with whole-image calls. */
+static void
+unfused_maps (const cv::Mat &a, const cv::Mat &b, float eps, cv::Mat &diff,
+    cv::Mat &ratio)
+{
+  cv::Mat fa, fb, ea, eb;
+  double sa = a.total () / std::max (cv::sum (a)[0], 1.0);
+  double sb = b.total () / std::max (cv::sum (b)[0], 1.0);
+  a.convertTo (fa, CV_32F, sa);
+  b.convertTo (fb, CV_32F, sb);
+  cv::subtract (fb, fa, diff);
+  cv::add (fa, cv::Scalar (eps), ea);
+  cv::add (fb, cv::Scalar (eps), eb);
+  cv::divide (eb, ea, ratio);
+}
+
+/* Writes the snapshots, and in hot[c * (days + 1) + d] the value of
+ * camera c's busy spot in its snapshot of day d. */
+static bool
+build_snapshots (const char *dir, int cameras, int days, long frames,
+    std::vector<int64_t> &hot, double *write_ms, double *mean_bytes)
+{
+  cv::Mat canvas;
+  double total_ms = 0, total_bytes = 0;
+  HeatmapDetection standing;
+  standing.left = HOT_SPOT_X - 20;
+  standing.top = HOT_SPOT_Y - 80;
+  standing.width = 40;
+  standing.height = 80;
+  standing.class_id = HEATMAP_CLASS_ID_PERSON;
+  standing.confidence = 0.9f;
+  hot.assign ((size_t) cameras * (days + 1), 0);
+  for (int c = 0; c < cameras; c++) {
+    HeatmapSource *src = heatmap_engine_get_source (c);
+    CrowdParams params;
+    params.width = WIDTH;
+    params.height = HEIGHT;
+    params.people = PEOPLE;
+    params.frames = frames;
+    params.source_id = c;
+    for (int d = 0; d <= days; d++) {
+      if (d) {
+        /* Odd cameras switch layout halfway through the month. */
+        int pattern = c % CROWD_NUM_PATTERNS;
+        if (c % 2 && d > days / 2)
+          pattern = (pattern + 1) % CROWD_NUM_PATTERNS;
+        params.pattern = (CrowdPattern) pattern;
+        params.seed = c * 1000 + d;
+        HeatmapReplay replay;
+        crowd_generate (params, &replay);
+        for (const HeatmapReplayFrame &frame : replay.frames)
+          heatmap_source_accumulate (src, replay.dets.data () + frame.first,
+              frame.count);
+        for (int f = 0; f < HOT_SPOT_FRAMES; f++)
+          heatmap_source_accumulate (src, &standing, 1);
+      }
+      heatmap_source_snapshot (src, HEATMAP_RENDER_MAP, canvas, NULL);
+      hot[(size_t) c * (days + 1) + d] =
+          canvas.at<int32_t> (HOT_SPOT_Y, HOT_SPOT_X);
+      double start = bench_now_ms ();
+      if (!heatmap_snapshot_save (dir, c, BASE_TIME + (int64_t) d * DAY_SEC,
+              canvas))
+        return false;
+      total_ms += bench_now_ms () - start;
+    }
+    std::vector<HeatmapSnapshotInfo> snapshots;
+    heatmap_snapshot_list (dir, c, snapshots);
+    for (const HeatmapSnapshotInfo &info : snapshots) {
+      FILE *fp = fopen (info.path.c_str (), "rb");
+      if (fp) {
+        fseek (fp, 0, SEEK_END);
+        total_bytes += ftell (fp);
+        fclose (fp);
+      }
+    }
+  }
+  *write_ms = total_ms / (cameras * (days + 1));
+  *mean_bytes = total_bytes / (cameras * (days + 1));
+  return true;
+}
+
+/* Whether period, as read back from the snapshots, has at the busy spot
+ * the difference of its values on days from and to. */
+static bool
+hot_spot_exact (const cv::Mat &period, const std::vector<int64_t> &hot,
+    int days, int camera, int from, int to)
+{
+  const int64_t *day = hot.data () + (size_t) camera * (days + 1);
+  return period.type () == CV_32SC1 &&
+      period.at<int32_t> (HOT_SPOT_Y, HOT_SPOT_X) == day[to] - day[from];
+}
+
+static void
+run_period (const char *dir, int cameras, int days,
+    const std::vector<int64_t> &hot, PeriodResult *res)
+{
+  HeatmapCompareParams params;
+  heatmap_compare_default_params (&params);
+  params.stamp_weight = heatmap_engine_geometry ()->stamp_weight;
+  int64_t a_from = BASE_TIME + (int64_t) res->a_from * DAY_SEC;
+  int64_t a_to = BASE_TIME + (int64_t) res->a_to * DAY_SEC;
+  int64_t b_from = BASE_TIME + (int64_t) res->b_from * DAY_SEC;
+  int64_t b_to = BASE_TIME + (int64_t) res->b_to * DAY_SEC;
+
+  Timing sum = Timing ();
+  HeatmapComparison result;
+  cv::Mat a, b, diff, ratio;
+  res->hot_spot_errors = 0;
+  for (int c = 0; c < cameras; c++) {
+    double start = bench_now_ms ();
+    heatmap_snapshot_period (dir, c, a_from, a_to, a);
+    heatmap_snapshot_period (dir, c, b_from, b_to, b);
+    sum.load_ms += bench_now_ms () - start;
+    if (!hot_spot_exact (a, hot, days, c, res->a_from, res->a_to) ||
+        !hot_spot_exact (b, hot, days, c, res->b_from, res->b_to))
+      res->hot_spot_errors++;
+
+    /* Warm up the outputs, then take the best of a few runs. */
+    heatmap_compare_maps (a, b, params, &result);
+    unfused_maps (a, b, params.ratio_epsilon, diff, ratio);
+    double fused = 1e9, unfused = 1e9;
+    for (int i = 0; i < KERNEL_REPEATS; i++) {
+      start = bench_now_ms ();
+      heatmap_compare_maps (a, b, params, &result);
+      fused = std::min (fused, bench_now_ms () - start);
+      start = bench_now_ms ();
+      unfused_maps (a, b, params.ratio_epsilon, diff, ratio);
+      unfused = std::min (unfused, bench_now_ms () - start);
+    }
+    sum.kernel_ms += fused;
+    sum.unfused_ms += unfused;
+
+    start = bench_now_ms ();
+    heatmap_compare_regions (params, &result);
+    sum.regions_ms += bench_now_ms () - start;
+    sum.regions += result.regions.size ();
+  }
+  res->mean.load_ms = sum.load_ms / cameras;
+  res->mean.kernel_ms = sum.kernel_ms / cameras;
+  res->mean.unfused_ms = sum.unfused_ms / cameras;
+  res->mean.regions_ms = sum.regions_ms / cameras;
+  res->mean.regions = sum.regions / cameras;
+
+  double start = bench_now_ms ();
+  for (int c = 0; c < cameras; c++)
+    heatmap_compare_periods (dir, c, a_from, a_to, b_from, b_to, params,
+        &result);
+  res->all_serial_ms = bench_now_ms () - start;
+
+  start = bench_now_ms ();
+  std::atomic<int> next (0);
+  unsigned int n = std::max (1u, std::thread::hardware_concurrency ());
+  std::vector<std::thread> workers;
+  for (unsigned int t = 0; t < n; t++)
+    workers.emplace_back ([&] {
+      HeatmapComparison local;
+      for (int c; (c = next++) < cameras;)
+        heatmap_compare_periods (dir, c, a_from, a_to, b_from, b_to, params,
+            &local);
+    });
+  for (std::thread &w : workers)
+    w.join ();
+  res->all_parallel_ms = bench_now_ms () - start;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *output = NULL;
+  const char *label = "";
+  int cameras = 16;
+  int days = 30;
+  long frames = 300;
+  bool keep = false;
+  int opt;
+  while ((opt = getopt (argc, argv, "o:c:d:f:kl:")) != -1) {
+    switch (opt) {
+      case 'o':
+        output = optarg;
+        break;
+      case 'c':
+        cameras = atoi (optarg);
+        break;
+      case 'd':
+        days = atoi (optarg);
+        break;
+      case 'f':
+        frames = atol (optarg);
+        break;
+      case 'k':
+        keep = true;
+        break;
+      case 'l':
+        label = optarg;
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-o results.json] [-c cameras] [-d days] "
+            "[-f frames_per_day] [-k] [-l label]\n", argv[0]);
+        return -1;
+    }
+  }
+  if (cameras <= 0 || cameras > HEATMAP_MAX_SOURCES || days < 14 ||
+      frames <= 0) {
+    fprintf (stderr, "invalid arguments\n");
+    return -1;
+  }
+
+  char dir[] = "/tmp/heatmap_snapshots_XXXXXX";
+  if (!mkdtemp (dir)) {
+    perror ("mkdtemp");
+    return -1;
+  }
+
+  HeatmapGeometry geometry;
+  heatmap_geometry_default (&geometry);
+  geometry.width = WIDTH;
+  geometry.height = HEIGHT;
+  geometry.accumulator = HEATMAP_ACCUMULATOR_INT32;
+  heatmap_engine_init_geometry (&geometry);
+  double write_ms, mean_bytes;
+  std::vector<int64_t> hot;
+  fprintf (stderr, "writing %d x %d snapshots to %s\n", cameras, days + 1,
+      dir);
+  if (!build_snapshots (dir, cameras, days, frames, hot, &write_ms,
+          &mean_bytes))
+    return -1;
+
+  PeriodResult periods[2];
+  periods[0].name = "first_vs_last_week";
+  periods[0].a_from = 0;
+  periods[0].a_to = 7;
+  periods[0].b_from = days - 7;
+  periods[0].b_to = days;
+  periods[1].name = "first_vs_second_half";
+  periods[1].a_from = 0;
+  periods[1].a_to = days / 2;
+  periods[1].b_from = days / 2;
+  periods[1].b_to = days;
+  for (PeriodResult &p : periods) {
+    run_period (dir, cameras, days, hot, &p);
+    fprintf (stderr, "%-22s load %.2f ms, kernel %.2f ms (unfused %.2f ms), "
+        "regions %.2f ms per camera; all %d cameras %.0f ms, %.0f ms "
+        "threaded%s\n", p.name, p.mean.load_ms, p.mean.kernel_ms,
+        p.mean.unfused_ms, p.mean.regions_ms, cameras, p.all_serial_ms,
+        p.all_parallel_ms, p.hot_spot_errors ? "  HOT SPOT MISMATCH" : "");
+  }
+
+  FILE *fp = output ? fopen (output, "w") : stdout;
+  if (!fp) {
+    perror (output);
+    return -1;
+  }
+  fprintf (fp, "{\n  \"benchmark\": \"compare\",\n  \"label\": \"%s\",\n"
+      "  \"width\": %d,\n  \"height\": %d,\n  \"cameras\": %d,\n"
+      "  \"days\": %d,\n  \"snapshot_write_ms\": %.2f,\n"
+      "  \"snapshot_bytes\": %.0f,\n  \"results\": [\n", label, WIDTH,
+      HEIGHT, cameras, days, write_ms, mean_bytes);
+  for (int i = 0; i < 2; i++) {
+    const PeriodResult &p = periods[i];
+    fprintf (fp, "    {\"periods\": \"%s\", \"load_ms\": %.3f, "
+        "\"kernel_ms\": %.3f, \"unfused_kernel_ms\": %.3f, "
+        "\"regions_ms\": %.3f, \"regions\": %zu, \"all_cameras_ms\": %.1f, "
+        "\"all_cameras_threaded_ms\": %.1f, \"hot_spot_exact\": %s}%s\n",
+        p.name, p.mean.load_ms, p.mean.kernel_ms, p.mean.unfused_ms,
+        p.mean.regions_ms, p.mean.regions, p.all_serial_ms,
+        p.all_parallel_ms, p.hot_spot_errors ? "false" : "true",
+        i ? "" : ",");
+  }
+  fprintf (fp, "  ]\n}\n");
+  if (output)
+    fclose (fp);
+
+  if (!keep) {
+    std::string cmd = std::string ("rm -rf ") + dir;
+    if (system (cmd.c_str ()) != 0)
+      fprintf (stderr, "failed to remove %s\n", dir);
+  } else {
+    fprintf (stderr, "snapshots kept in %s\n", dir);
+  }
+  return periods[0].hot_spot_errors || periods[1].hot_spot_errors ? 1 : 0;
+}
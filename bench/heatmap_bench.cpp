@@ -0,0 +1,190 @@
+/*
+ * Heatmap engine benchmark.
+ *
+ * Drives accumulation and rendering with synthetic crowds (uniform, queues,
+ * corridors) from 1 to 500 people per frame and writes one JSON record per
+ * scenario: detections/sec, render time, resident memory before and after
+ * the scenario and, where perf events are available, hardware cache misses
+ * during accumulation. Sources of earlier scenarios stay resident, so a
+ * scenario's own footprint is rss_after_kb - rss_before_kb.
+ *
+ * Usage: heatmap_bench [-o results.json] [-f frames] [-r renders] [-l label]
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "bench_common.h"
+#include "../heatmap_engine.h"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#define WIDTH 1280
+#define HEIGHT 780
+
+static const int densities[] = { 1, 10, 50, 100, 250, 500 };
+#define NUM_DENSITIES (int) (sizeof (densities) / sizeof (densities[0]))
+
+struct ScenarioResult {
+  CrowdPattern pattern;
+  int people;
+  size_t detections;
+  double accumulate_ms;
+  double render_ms_mean;
+  double render_ms_max;
+  uint64_t cache_misses;
+  uint64_t cache_refs;
+  long rss_before_kb;
+  long rss_after_kb;
+};
+
+static void
+run_scenario (CrowdPattern pattern, int people, unsigned int source_id,
+    long frames, int renders, BenchPerfCounters *perf, ScenarioResult *res)
+{
+  res->rss_before_kb = bench_current_rss_kb ();
+  HeatmapReplay replay;
+  CrowdParams params;
+  params.pattern = pattern;
+  params.width = WIDTH;
+  params.height = HEIGHT;
+  params.people = people;
+  params.frames = frames;
+  params.source_id = source_id;
+  params.seed = 1234 + source_id;
+  crowd_generate (params, &replay);
+
+  HeatmapSource *src = heatmap_engine_get_source (source_id);
+  res->pattern = pattern;
+  res->people = people;
+  res->detections = replay.dets.size ();
+
+  bench_perf_start (perf);
+  double start = bench_now_ms ();
+  for (const HeatmapReplayFrame &frame : replay.frames)
+    heatmap_source_accumulate (src, replay.dets.data () + frame.first,
+        frame.count);
+  res->accumulate_ms = bench_now_ms () - start;
+  bench_perf_stop (perf, &res->cache_misses, &res->cache_refs);
+
+  cv::Mat frame_bgra (HEIGHT, WIDTH, CV_8UC4, cv::Scalar (40, 80, 120, 255));
+  heatmap_source_update_background (src, frame_bgra, cv::COLOR_RGBA2RGB);
+  HeatmapRenderParams render;
+  render.mode = HEATMAP_RENDER_OVERLAY;
+  render.colormap = cv::COLORMAP_JET;
+  render.alpha = 0.75;
+  render.window = cv::Rect ();
+
+  /* The first render warms the workspace and is not counted. */
+  heatmap_source_render (src, render);
+  double total = 0, worst = 0;
+  for (int i = 0; i < renders; i++) {
+    start = bench_now_ms ();
+    heatmap_source_render (src, render);
+    double ms = bench_now_ms () - start;
+    total += ms;
+    worst = std::max (worst, ms);
+  }
+  res->render_ms_mean = renders ? total / renders : 0;
+  res->render_ms_max = worst;
+  /* While the scenario's detections are still held. */
+  res->rss_after_kb = bench_current_rss_kb ();
+}
+
+static void
+write_json (FILE *fp, const char *label, long frames, int renders,
+    bool perf_available, const std::vector<ScenarioResult> &results)
+{
+  fprintf (fp, "{\n  \"benchmark\": \"heatmap\",\n  \"label\": \"%s\",\n"
+      "  \"width\": %d,\n  \"height\": %d,\n  \"frames\": %ld,\n"
+      "  \"renders\": %d,\n  \"perf_events\": %s,\n  \"results\": [\n",
+      label, WIDTH, HEIGHT, frames, renders, perf_available ? "true" : "false");
+  for (size_t i = 0; i < results.size (); i++) {
+    const ScenarioResult &r = results[i];
+    fprintf (fp, "    {\"pattern\": \"%s\", \"people\": %d, "
+        "\"detections\": %zu, \"accumulate_ms\": %.3f, "
+        "\"detections_per_sec\": %.0f, \"render_ms_mean\": %.3f, "
+        "\"render_ms_max\": %.3f, ",
+        crowd_pattern_name (r.pattern), r.people, r.detections,
+        r.accumulate_ms,
+        r.accumulate_ms > 0 ? r.detections / (r.accumulate_ms / 1e3) : 0.0,
+        r.render_ms_mean, r.render_ms_max);
+    if (perf_available)
+      fprintf (fp, "\"cache_misses\": %llu, \"cache_references\": %llu, ",
+          (unsigned long long) r.cache_misses,
+          (unsigned long long) r.cache_refs);
+    else
+      fprintf (fp, "\"cache_misses\": null, \"cache_references\": null, ");
+    fprintf (fp, "\"rss_before_kb\": %ld, \"rss_after_kb\": %ld}%s\n",
+        r.rss_before_kb, r.rss_after_kb, i + 1 < results.size () ? "," : "");
+  }
+  fprintf (fp, "  ],\n  \"peak_rss_kb\": %ld\n}\n", bench_peak_rss_kb ());
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *output = NULL;
+  const char *label = "";
+  long frames = 900;
+  int renders = 30;
+  int opt;
+  while ((opt = getopt (argc, argv, "o:f:r:l:")) != -1) {
+    switch (opt) {
+      case 'o':
+        output = optarg;
+        break;
+      case 'f':
+        frames = atol (optarg);
+        break;
+      case 'r':
+        renders = atoi (optarg);
+        break;
+      case 'l':
+        label = optarg;
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-o results.json] [-f frames] "
+            "[-r renders] [-l label]\n", argv[0]);
+        return -1;
+    }
+  }
+  if (frames <= 0 || renders < 0 ||
+      CROWD_NUM_PATTERNS * NUM_DENSITIES > HEATMAP_MAX_SOURCES) {
+    fprintf (stderr, "invalid arguments\n");
+    return -1;
+  }
+
+  heatmap_engine_init (WIDTH, HEIGHT);
+  BenchPerfCounters perf;
+  bench_perf_open (&perf);
+
+  std::vector<ScenarioResult> results;
+  unsigned int source_id = 0;
+  for (int p = 0; p < CROWD_NUM_PATTERNS; p++) {
+    for (int d = 0; d < NUM_DENSITIES; d++) {
+      ScenarioResult res;
+      run_scenario ((CrowdPattern) p, densities[d], source_id++, frames,
+          renders, &perf, &res);
+      fprintf (stderr, "%-10s %4d people: %10.0f det/s, render %.2f ms, "
+          "rss +%ld KiB\n", crowd_pattern_name (res.pattern), res.people,
+          res.accumulate_ms > 0 ? res.detections / (res.accumulate_ms / 1e3) :
+          0.0, res.render_ms_mean, res.rss_after_kb - res.rss_before_kb);
+      results.push_back (res);
+    }
+  }
+
+  FILE *fp = output ? fopen (output, "w") : stdout;
+  if (!fp) {
+    perror (output);
+    return -1;
+  }
+  write_json (fp, label, frames, renders, perf.available, results);
+  if (output)
+    fclose (fp);
+  bench_perf_close (&perf);
+  return 0;
+}
@@ -0,0 +1,337 @@
+/*
+ * Benchmark and check of the accumulation and render kernels
+ * (heatmap_kernels.h).
+ *
+ * For every combination of canvas size, accumulator type, stamp shape and
+ * radius, stamps the footpoints of a synthetic crowd with the kernel
+ * heatmap_kernels_select picks, and again the way the app did before the
+ * kernels: circle() (rectangle() for squares) of each detection's value,
+ * added to the canvas with saturation. Both are timed, and the speedup of
+ * the kernel over circle() + add is reported. The crowd is preceded by
+ * HOT_SPOT_POINTS detections on one spot, so that uint16 canvases
+ * saturate. Then colour-maps the canvas with the kernel and with the plain
+ * OpenCV convertTo + cvtColor + LUT sequence. Fails unless both pairs
+ * agree exactly. Writes JSON.
+ *
+ * Usage: kernel_bench [-o results.json] [-f frames] [-p people] [-l label]
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <limits.h>
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "bench_common.h"
+#include "../heatmap_kernels.h"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#define REPEATS 5
+/* 5 per detection at the default stamp weight, well past 65535. */
+#define HOT_SPOT_POINTS 16000
+
+static const int sizes[][2] = { { 1280, 720 }, { 1280, 780 }, { 1920, 1080 } };
+static const int radii[] = { 5, 10, 20 };
+static const HeatmapAccumulator accumulators[] = {
+  HEATMAP_ACCUMULATOR_UINT16, HEATMAP_ACCUMULATOR_INT32,
+  HEATMAP_ACCUMULATOR_FLOAT,
+};
+static const char *accumulator_names[] = { "uint16", "int32", "float" };
+static const HeatmapStampShape shapes[] = {
+  HEATMAP_STAMP_DISC, HEATMAP_STAMP_SQUARE,
+};
+static const char *shape_names[] = { "disc", "square" };
+
+#define NUM_SIZES (int) (sizeof (sizes) / sizeof (sizes[0]))
+#define NUM_RADII (int) (sizeof (radii) / sizeof (radii[0]))
+#define NUM_ACCUMULATORS \
+  (int) (sizeof (accumulators) / sizeof (accumulators[0]))
+#define NUM_SHAPES (int) (sizeof (shapes) / sizeof (shapes[0]))
+
+/* A crowd's footpoints; frame f is points[first[f]] up to
+ * points[first[f + 1]]. */
+struct Footpoints {
+  std::vector<HeatmapFootpoint> points;
+  std::vector<size_t> first;
+};
+
+struct Result {
+  int width, height, radius;
+  const char *accumulator;
+  const char *shape;
+  const char *kernels;
+  double accumulate_ms;
+  double reference_ms;
+  double colorize_ms;
+  double opencv_colorize_ms;
+  bool identical;
+};
+
+static void
+build_footpoints (int width, int height, int people, long frames,
+    Footpoints *fp)
+{
+  CrowdParams params;
+  params.pattern = CROWD_CORRIDORS;
+  params.width = width;
+  params.height = height;
+  params.people = people;
+  params.frames = frames;
+  params.source_id = 0;
+  params.seed = 99;
+  HeatmapReplay replay;
+  crowd_generate (params, &replay);
+
+  HeatmapWeighting weighting;
+  heatmap_weighting_default (&weighting);
+  FootpointFilter filter;
+  footpoint_filter_init (&filter, people * 2);
+  HeatmapFootpoint hot = { width / 2, height / 2, 1.0f };
+  fp->points.assign (HOT_SPOT_POINTS, hot);
+  fp->first.assign (1, 0);
+  fp->first.push_back (fp->points.size ());
+  for (const HeatmapReplayFrame &frame : replay.frames) {
+    size_t n = footpoint_filter_run (&filter, &weighting,
+        replay.dets.data () + frame.first, frame.count);
+    fp->points.insert (fp->points.end (), filter.points.begin (),
+        filter.points.begin () + n);
+    fp->first.push_back (fp->points.size ());
+  }
+}
+
+/* Best of REPEATS runs over all frames, each from an empty canvas. */
+static double
+time_accumulate (const HeatmapKernels *k, const Footpoints &fp,
+    const HeatmapStamp &stamp, cv::Mat &canvas)
+{
+  double best = 1e9;
+  for (int r = 0; r < REPEATS; r++) {
+    canvas.setTo (0);
+    double start = bench_now_ms ();
+    for (size_t f = 0; f + 1 < fp.first.size (); f++)
+      k->accumulate (canvas, fp.points.data () + fp.first[f],
+          fp.first[f + 1] - fp.first[f], stamp);
+    best = std::min (best, bench_now_ms () - start);
+  }
+  return best;
+}
+
+/* The value the reference stamps for weight, rounded and clamped like the
+ * kernels do; false for points that add nothing. */
+static bool
+reference_value (int type, float weight, float stamp_weight, double *value)
+{
+  if (type == CV_32FC1) {
+    float v = weight * stamp_weight;
+    *value = v;
+    return v > 0;
+  }
+  long long r = llround (weight * stamp_weight);
+  *value = (double) std::min (r, type == CV_16UC1 ? 0xffffLL :
+      (long long) INT32_MAX);
+  return r > 0;
+}
+
+/* circle() or rectangle() of each point's value on a blank image, added to
+ * canvas. The image only covers the stamp's bounding box, which stamps the
+ * same pixels as a canvas-sized one. */
+static void
+reference_accumulate (const Footpoints &fp, HeatmapStampShape shape,
+    int radius, float stamp_weight, cv::Mat &canvas)
+{
+  const int size = 2 * radius + 1;
+  cv::Mat patch (size, size, canvas.type ());
+  const cv::Rect bounds (0, 0, canvas.cols, canvas.rows);
+  canvas.setTo (0);
+  for (const HeatmapFootpoint &p : fp.points) {
+    double value;
+    if (!reference_value (canvas.type (), p.weight, stamp_weight, &value))
+      continue;
+    cv::Rect box (p.x - radius, p.y - radius, size, size);
+    cv::Rect inside = box & bounds;
+    if (inside.empty ())
+      continue;
+    patch.setTo (0);
+    if (shape == HEATMAP_STAMP_SQUARE)
+      cv::rectangle (patch, cv::Rect (0, 0, size, size), cv::Scalar (value),
+          -1);
+    else
+      cv::circle (patch, cv::Point (radius, radius), radius,
+          cv::Scalar (value), -1);
+    cv::Mat roi = canvas (inside);
+    cv::add (roi, patch (cv::Rect (inside.x - box.x, inside.y - box.y,
+                inside.width, inside.height)), roi);
+  }
+}
+
+static double
+time_reference (const Footpoints &fp, HeatmapStampShape shape, int radius,
+    float stamp_weight, cv::Mat &canvas)
+{
+  double best = 1e9;
+  for (int r = 0; r < REPEATS; r++) {
+    double start = bench_now_ms ();
+    reference_accumulate (fp, shape, radius, stamp_weight, canvas);
+    best = std::min (best, bench_now_ms () - start);
+  }
+  return best;
+}
+
+static double
+time_colorize (HeatmapColorizeFn colorize, const cv::Mat &canvas,
+    const cv::Mat &lut, cv::Mat &image)
+{
+  double best = 1e9;
+  colorize (canvas, lut, image);
+  for (int r = 0; r < REPEATS; r++) {
+    double start = bench_now_ms ();
+    colorize (canvas, lut, image);
+    best = std::min (best, bench_now_ms () - start);
+  }
+  return best;
+}
+
+static void
+opencv_colorize (const cv::Mat &canvas, const cv::Mat &lut, cv::Mat &image)
+{
+  static cv::Mat gray, bgr;
+  canvas.convertTo (gray, CV_8UC1);
+  cv::cvtColor (gray, bgr, cv::COLOR_GRAY2BGR);
+  cv::LUT (bgr, lut, image);
+}
+
+static bool
+same (const cv::Mat &a, const cv::Mat &b)
+{
+  if (a.size () != b.size () || a.type () != b.type ())
+    return false;
+  for (int y = 0; y < a.rows; y++) {
+    if (memcmp (a.ptr (y), b.ptr (y), a.cols * a.elemSize ()))
+      return false;
+  }
+  return true;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *output = NULL;
+  const char *label = "";
+  long frames = 300;
+  int people = 100;
+  int opt;
+  while ((opt = getopt (argc, argv, "o:f:p:l:")) != -1) {
+    switch (opt) {
+      case 'o':
+        output = optarg;
+        break;
+      case 'f':
+        frames = atol (optarg);
+        break;
+      case 'p':
+        people = atoi (optarg);
+        break;
+      case 'l':
+        label = optarg;
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-o results.json] [-f frames] "
+            "[-p people] [-l label]\n", argv[0]);
+        return -1;
+    }
+  }
+  if (frames <= 0 || people <= 0) {
+    fprintf (stderr, "invalid arguments\n");
+    return -1;
+  }
+
+  cv::Mat ramp (1, 256, CV_8UC1), lut;
+  for (int i = 0; i < 256; i++)
+    ramp.at<uchar> (0, i) = (uchar) i;
+  cv::applyColorMap (ramp, lut, cv::COLORMAP_JET);
+
+  std::vector<Result> results;
+  Footpoints fp;
+  for (int s = 0; s < NUM_SIZES; s++) {
+    build_footpoints (sizes[s][0], sizes[s][1], people, frames, &fp);
+    for (int a = 0; a < NUM_ACCUMULATORS; a++) {
+      for (int sh = 0; sh < NUM_SHAPES; sh++) {
+        for (int r = 0; r < NUM_RADII; r++) {
+          HeatmapGeometry g;
+          heatmap_geometry_default (&g);
+          g.width = sizes[s][0];
+          g.height = sizes[s][1];
+          g.accumulator = accumulators[a];
+          g.stamp_shape = shapes[sh];
+          g.stamp_radius = radii[r];
+          const HeatmapKernels *kernels = heatmap_kernels_select (&g);
+          HeatmapStamp stamp;
+          heatmap_stamp_init (&stamp, g.stamp_shape, g.stamp_radius,
+              g.stamp_weight);
+
+          Result res;
+          res.width = g.width;
+          res.height = g.height;
+          res.radius = g.stamp_radius;
+          res.accumulator = accumulator_names[a];
+          res.shape = shape_names[sh];
+          res.kernels = kernels->name;
+          int type = heatmap_accumulator_type (g.accumulator);
+          cv::Mat canvas (g.height, g.width, type);
+          cv::Mat reference (g.height, g.width, type);
+          res.accumulate_ms = time_accumulate (kernels, fp, stamp, canvas);
+          res.reference_ms = time_reference (fp, g.stamp_shape,
+              g.stamp_radius, g.stamp_weight, reference);
+
+          cv::Mat image, opencv_image;
+          res.colorize_ms = time_colorize (kernels->colorize, canvas, lut,
+              image);
+          res.opencv_colorize_ms = time_colorize (opencv_colorize, canvas,
+              lut, opencv_image);
+          res.identical = same (canvas, reference) &&
+              same (image, opencv_image);
+          results.push_back (res);
+
+          fprintf (stderr, "%-6s %-6s r%-2d %4dx%-4d  accumulate %7.2f ms"
+              " (circle+add %7.2f, x%.1f)  colorize %6.2f ms (opencv %6.2f)"
+              "%s\n", res.kernels, res.shape, res.radius, res.width,
+              res.height, res.accumulate_ms, res.reference_ms,
+              res.reference_ms / res.accumulate_ms, res.colorize_ms,
+              res.opencv_colorize_ms, res.identical ? "" : "  MISMATCH");
+        }
+      }
+    }
+  }
+
+  FILE *out = output ? fopen (output, "w") : stdout;
+  if (!out) {
+    perror (output);
+    return -1;
+  }
+  fprintf (out, "{\n  \"benchmark\": \"kernels\",\n  \"label\": \"%s\",\n"
+      "  \"frames\": %ld,\n  \"people\": %d,\n  \"results\": [\n", label,
+      frames, people);
+  bool all_identical = true;
+  for (size_t i = 0; i < results.size (); i++) {
+    const Result &r = results[i];
+    all_identical = all_identical && r.identical;
+    fprintf (out, "    {\"width\": %d, \"height\": %d, \"accumulator\": "
+        "\"%s\", \"shape\": \"%s\", \"radius\": %d, \"kernels\": \"%s\", "
+        "\"accumulate_ms\": %.3f, \"circle_add_ms\": %.3f, "
+        "\"accumulate_speedup\": %.2f, \"colorize_ms\": %.3f, "
+        "\"opencv_colorize_ms\": %.3f, \"identical\": %s}%s\n", r.width,
+        r.height, r.accumulator, r.shape, r.radius, r.kernels,
+        r.accumulate_ms, r.reference_ms, r.reference_ms / r.accumulate_ms,
+        r.colorize_ms, r.opencv_colorize_ms,
+        r.identical ? "true" : "false", i + 1 == results.size () ? "" : ",");
+  }
+  fprintf (out, "  ]\n}\n");
+  if (output)
+    fclose (out);
+  return all_identical ? 0 : 1;
+}
@@ -0,0 +1,276 @@
+/*
+ * Benchmark of the occupancy stats.
+ *
+ * Feeds 50 cameras x 2 days of synthetic people counts, one frame a second
+ * per camera, through occupancy_update with the app's interval and ring
+ * size, so every ring is recycled once. Cameras range from a few people to
+ * a few hundred, following a daily cycle. Then reports the memory of all
+ * trackers via occupancy_memory_bytes, the time per update and per query,
+ * and the p50/p90/p99 of each query against exact quantiles of the same
+ * counts:
+ *   - each camera's lifetime totals,
+ *   - each camera's last hour, merged from its intervals,
+ *   - all cameras over the last day, merged across intervals and sources.
+ * Also checks that each ring holds exactly the last num_intervals intervals
+ * and that the recycled first day no longer matches. Writes JSON, and fails
+ * if a quantile is off by more than the sketch's 12.5% bound, a ring is
+ * wrong, or the memory exceeds the 2.5 MiB per 50 cameras that
+ * occupancy_stats.h promises.
+ *
+ * Usage: occupancy_bench [-o results.json] [-c cameras] [-d days]
+ *                        [-r frames_per_sec] [-l label]
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "bench_common.h"
+#include "../heatmap_engine.h"
+#include "../occupancy_stats.h"
+
+#define DAY_SEC 86400
+#define HOUR_SEC 3600
+#define BASE_TIME 1700000000
+#define MAX_RELATIVE_ERROR 0.125
+#define MEMORY_BUDGET_PER_CAMERA (2.5 * 1024 * 1024 / 50)
+#define NUM_QUANTILES 3
+
+static const double quantiles[NUM_QUANTILES] = { 0.50, 0.90, 0.99 };
+
+struct QueryResult {
+  const char *name;
+  /* Queries run, and time per query. */
+  int queries;
+  double query_ms;
+  /* Worst error over the queries, per quantile. */
+  double max_abs_error[NUM_QUANTILES];
+  double max_rel_error[NUM_QUANTILES];
+};
+
+/* The value of rank ceil(q * n), the one occupancy_sketch_quantile
+ * estimates. Reorders values. */
+static double
+exact_quantile (std::vector<uint32_t> &values, double q)
+{
+  size_t rank = (size_t) ceil (q * values.size ());
+  size_t index = rank ? rank - 1 : 0;
+  std::nth_element (values.begin (), values.begin () + index, values.end ());
+  return values[index];
+}
+
+static void
+check_quantiles (const OccupancySummary &summary,
+    std::vector<uint32_t> &values, QueryResult *res)
+{
+  const double estimates[NUM_QUANTILES] =
+      { summary.p50, summary.p90, summary.p99 };
+  for (int i = 0; i < NUM_QUANTILES; i++) {
+    double exact = exact_quantile (values, quantiles[i]);
+    double error = fabs (estimates[i] - exact);
+    res->max_abs_error[i] = std::max (res->max_abs_error[i], error);
+    res->max_rel_error[i] = std::max (res->max_rel_error[i],
+        error / std::max (exact, 1.0));
+  }
+}
+
+static bool
+within_bound (const QueryResult &res)
+{
+  for (int i = 0; i < NUM_QUANTILES; i++) {
+    if (res.max_rel_error[i] > MAX_RELATIVE_ERROR)
+      return false;
+  }
+  return true;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *output = NULL;
+  const char *label = "";
+  int cameras = 50;
+  int days = 2;
+  int rate = 1;
+  int opt;
+  while ((opt = getopt (argc, argv, "o:c:d:r:l:")) != -1) {
+    switch (opt) {
+      case 'o':
+        output = optarg;
+        break;
+      case 'c':
+        cameras = atoi (optarg);
+        break;
+      case 'd':
+        days = atoi (optarg);
+        break;
+      case 'r':
+        rate = atoi (optarg);
+        break;
+      case 'l':
+        label = optarg;
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-o results.json] [-c cameras] [-d days] "
+            "[-r frames_per_sec] [-l label]\n", argv[0]);
+        return -1;
+    }
+  }
+  /* Less than two days would not fill and recycle the default ring. */
+  if (cameras <= 0 || cameras > HEATMAP_MAX_SOURCES || days < 2 ||
+      rate <= 0) {
+    fprintf (stderr, "invalid arguments\n");
+    return -1;
+  }
+
+  const int interval_sec = OCCUPANCY_DEFAULT_INTERVAL_SEC;
+  const int num_intervals = OCCUPANCY_DEFAULT_INTERVALS;
+  occupancy_init (interval_sec, num_intervals);
+  for (int c = 0; c < cameras; c++)
+    occupancy_add_source (c);
+
+  /* Start on an interval boundary so the last day is whole intervals. */
+  const int64_t base = BASE_TIME - BASE_TIME % interval_sec;
+  const int64_t end = base + (int64_t) days * DAY_SEC;
+  const int64_t frame_us = 1000000 / rate;
+  const int64_t frames = (int64_t) days * DAY_SEC * rate;
+
+  /* Every count, per camera, for the exact quantiles. */
+  std::vector<std::vector<uint32_t> > counts (cameras);
+  std::vector<double> scale (cameras);
+  std::mt19937 rng (11);
+  std::uniform_real_distribution<double> log_scale (0, log (400.0));
+  for (int c = 0; c < cameras; c++) {
+    scale[c] = exp (log_scale (rng));
+    counts[c].reserve (frames);
+  }
+
+  fprintf (stderr, "feeding %d cameras x %d days at %d frames/s\n", cameras,
+      days, rate);
+  double update_ms = 0;
+  std::vector<uint32_t> frame_counts (cameras);
+  for (int64_t f = 0; f < frames; f++) {
+    int64_t timestamp_us = base * 1000000 + f * frame_us;
+    /* Quiet at night, busiest mid-afternoon. */
+    double hour = fmod ((double) timestamp_us / 1e6, DAY_SEC) / HOUR_SEC;
+    double busy = 0.05 + 0.95 * pow (sin (M_PI * hour / 24), 4);
+    for (int c = 0; c < cameras; c++) {
+      std::poisson_distribution<int> people (scale[c] * busy);
+      frame_counts[c] = people (rng);
+      counts[c].push_back (frame_counts[c]);
+    }
+    double start = bench_now_ms ();
+    for (int c = 0; c < cameras; c++)
+      occupancy_update (c, frame_counts[c], timestamp_us);
+    update_ms += bench_now_ms () - start;
+  }
+  double update_ns = update_ms * 1e6 / (frames * cameras);
+
+  size_t memory = occupancy_memory_bytes ();
+  double budget = MEMORY_BUDGET_PER_CAMERA * cameras;
+  fprintf (stderr, "memory %zu bytes (%.2f MiB, %.1f KiB per camera, budget "
+      "%.2f MiB), update %.1f ns\n", memory, memory / 1048576.0,
+      memory / 1024.0 / cameras, budget / 1048576.0, update_ns);
+
+  QueryResult results[3] = {};
+  results[0].name = "camera_lifetime";
+  results[1].name = "camera_last_hour";
+  results[2].name = "all_cameras_last_day";
+  int64_t hour_frames = (int64_t) HOUR_SEC * rate;
+  int64_t day_frames = (int64_t) DAY_SEC * rate;
+  OccupancySummary summary;
+  std::vector<uint32_t> values;
+  for (int c = 0; c < cameras; c++) {
+    unsigned int id = c;
+    double start = bench_now_ms ();
+    occupancy_query (&id, 1, 0, 0, &summary);
+    results[0].query_ms += bench_now_ms () - start;
+    values = counts[c];
+    check_quantiles (summary, values, &results[0]);
+
+    start = bench_now_ms ();
+    occupancy_query (&id, 1, (end - HOUR_SEC) * 1000000, end * 1000000,
+        &summary);
+    results[1].query_ms += bench_now_ms () - start;
+    values.assign (counts[c].end () - hour_frames, counts[c].end ());
+    check_quantiles (summary, values, &results[1]);
+  }
+  results[0].queries = results[1].queries = cameras;
+
+  double start = bench_now_ms ();
+  occupancy_query (NULL, 0, (end - DAY_SEC) * 1000000, end * 1000000,
+      &summary);
+  results[2].query_ms = bench_now_ms () - start;
+  results[2].queries = 1;
+  values.clear ();
+  for (int c = 0; c < cameras; c++)
+    values.insert (values.end (), counts[c].end () - day_frames,
+        counts[c].end ());
+  check_quantiles (summary, values, &results[2]);
+
+  bool quantiles_ok = true;
+  for (QueryResult &res : results) {
+    res.query_ms /= res.queries;
+    quantiles_ok = quantiles_ok && within_bound (res);
+    fprintf (stderr, "%-21s query %.3f ms, error p50 %.1f (%.1f%%), p90 %.1f "
+        "(%.1f%%), p99 %.1f (%.1f%%)%s\n", res.name, res.query_ms,
+        res.max_abs_error[0], 100 * res.max_rel_error[0],
+        res.max_abs_error[1], 100 * res.max_rel_error[1],
+        res.max_abs_error[2], 100 * res.max_rel_error[2],
+        within_bound (res) ? "" : "  OUT OF BOUND");
+  }
+
+  /* Each ring must hold the last num_intervals intervals, each full. */
+  int ring_errors = 0;
+  std::vector<OccupancyInterval> intervals;
+  for (int c = 0; c < cameras; c++) {
+    occupancy_list_intervals (c, intervals);
+    bool ok = intervals.size () == (size_t) num_intervals;
+    for (size_t i = 0; ok && i < intervals.size (); i++) {
+      int64_t expected = (end - (int64_t) (num_intervals - i) * interval_sec)
+          * 1000000;
+      ok = intervals[i].start_us == expected &&
+          intervals[i].sketch.frames == (uint64_t) interval_sec * rate;
+    }
+    if (!ok)
+      ring_errors++;
+  }
+  bool recycled = !occupancy_query (NULL, 0, base * 1000000,
+      (end - (int64_t) num_intervals * interval_sec) * 1000000, &summary);
+  fprintf (stderr, "rings: %d of %d wrong, oldest intervals %s\n",
+      ring_errors, cameras, recycled ? "recycled" : "STILL MATCHED");
+
+  FILE *fp = output ? fopen (output, "w") : stdout;
+  if (!fp) {
+    perror (output);
+    return -1;
+  }
+  fprintf (fp, "{\n  \"benchmark\": \"occupancy\",\n  \"label\": \"%s\",\n"
+      "  \"cameras\": %d,\n  \"days\": %d,\n  \"frames_per_sec\": %d,\n"
+      "  \"interval_sec\": %d,\n  \"intervals\": %d,\n"
+      "  \"memory_bytes\": %zu,\n  \"memory_budget_bytes\": %.0f,\n"
+      "  \"update_ns\": %.1f,\n  \"ring_errors\": %d,\n"
+      "  \"recycled\": %s,\n  \"results\": [\n", label, cameras, days, rate,
+      interval_sec, num_intervals, memory, budget, update_ns, ring_errors,
+      recycled ? "true" : "false");
+  for (int i = 0; i < 3; i++) {
+    const QueryResult &res = results[i];
+    fprintf (fp, "    {\"query\": \"%s\", \"queries\": %d, "
+        "\"query_ms\": %.4f", res.name, res.queries, res.query_ms);
+    for (int q = 0; q < NUM_QUANTILES; q++)
+      fprintf (fp, ", \"p%.0f_abs_error\": %.2f, \"p%.0f_rel_error\": %.4f",
+          100 * quantiles[q], res.max_abs_error[q], 100 * quantiles[q],
+          res.max_rel_error[q]);
+    fprintf (fp, "}%s\n", i < 2 ? "," : "");
+  }
+  fprintf (fp, "  ]\n}\n");
+  if (output)
+    fclose (fp);
+
+  return quantiles_ok && !ring_errors && recycled && memory <= budget ? 0 : 1;
+}
@@ -0,0 +1,259 @@
+/*
+ * Load test for the heatmap query server.
+ *
+ * Starts the server in-process on a free localhost port, feeds synthetic
+ * detections into a few sources at the pipeline frame rate and hammers the
+ * endpoints from keep-alive client threads, more of them than the server
+ * has workers. Prints requests/sec, the encoded-image cache hit rate and
+ * request latency percentiles overall and per client, so a client starved
+ * by the others shows up.
+ *
+ * Usage: server_load [seconds] [clients] [sources] [fps]
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../heatmap_engine.h"
+#include "../heatmap_server.h"
+#include "opencv2/imgproc/imgproc.hpp"
+
+using namespace std;
+
+#define WIDTH 1280
+#define HEIGHT 780
+#define PEOPLE_PER_FRAME 20
+
+static std::atomic<bool> done (false);
+
+struct ClientResult {
+  uint64_t completed;
+  uint64_t failed;
+  /* Milliseconds per successful request. */
+  vector<double> latencies;
+};
+
+static int
+connect_local (int port)
+{
+  int fd = socket (AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in sa;
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (connect (fd, (struct sockaddr *) &sa, sizeof (sa)) < 0) {
+    close (fd);
+    return -1;
+  }
+  int one = 1;
+  setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+  return fd;
+}
+
+/* Sends one GET and reads the full response. Returns the status code or -1
+ * if the connection broke. */
+static int
+http_get (int fd, const string &path, string &buffer)
+{
+  string req = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  if (send (fd, req.data (), req.size (), MSG_NOSIGNAL) != (ssize_t) req.size ())
+    return -1;
+
+  char chunk[65536];
+  size_t end;
+  while ((end = buffer.find ("\r\n\r\n")) == string::npos) {
+    ssize_t n = recv (fd, chunk, sizeof (chunk), 0);
+    if (n <= 0)
+      return -1;
+    buffer.append (chunk, n);
+  }
+  int status = atoi (buffer.c_str () + 9);
+  size_t cl = buffer.find ("Content-Length: ");
+  size_t body_len = cl < end ? strtoul (buffer.c_str () + cl + 16, NULL, 10) : 0;
+  size_t total = end + 4 + body_len;
+  while (buffer.size () < total) {
+    ssize_t n = recv (fd, chunk, sizeof (chunk), 0);
+    if (n <= 0)
+      return -1;
+    buffer.append (chunk, n);
+  }
+  buffer.erase (0, total);
+  return status;
+}
+
+static void
+client_loop (int port, int num_sources, unsigned int seed,
+    ClientResult *result)
+{
+  /* A dashboard-like mix: mostly full overlays, some zoomed tiles, some raw
+   * data. */
+  static const char *paths[] = {
+    "/heatmap?source=%d",
+    "/heatmap?source=%d",
+    "/heatmap?source=%d&mode=map",
+    "/heatmap?source=%d&format=jpg",
+    "/heatmap?source=%d&x=0&y=0&w=640&h=390",
+    "/heatmap?source=%d&x=640&y=390&w=640&h=390&colormap=11",
+    "/zones?source=%d&rows=4&cols=4",
+    "/grid?source=%d",
+  };
+  mt19937 rng (seed);
+  string buffer;
+  int fd = connect_local (port);
+  while (!done && fd >= 0) {
+    char path[128];
+    snprintf (path, sizeof (path), paths[rng () % 8], (int) (rng () % num_sources));
+    auto start = chrono::steady_clock::now ();
+    int status = http_get (fd, path, buffer);
+    if (status == 200) {
+      result->completed++;
+      result->latencies.push_back (chrono::duration<double, milli> (
+              chrono::steady_clock::now () - start).count ());
+    } else {
+      result->failed++;
+      if (status < 0) {
+        close (fd);
+        buffer.clear ();
+        fd = connect_local (port);
+      }
+    }
+  }
+  if (fd >= 0)
+    close (fd);
+}
+
+static void
+producer_loop (int num_sources, int fps)
+{
+  mt19937 rng (1);
+  uniform_real_distribution<float> ux (0, WIDTH - 40), uy (0, HEIGHT - 120);
+  HeatmapDetection dets[PEOPLE_PER_FRAME];
+  cv::Mat frame (HEIGHT, WIDTH, CV_8UC3, cv::Scalar (60, 60, 60));
+  long frame_number = 0;
+  auto next = chrono::steady_clock::now ();
+  while (!done) {
+    for (int s = 0; s < num_sources; s++) {
+      HeatmapSource *src = heatmap_engine_get_source (s);
+      for (int i = 0; i < PEOPLE_PER_FRAME; i++) {
+        dets[i].left = ux (rng);
+        dets[i].top = uy (rng);
+        dets[i].width = 40;
+        dets[i].height = 120;
+        dets[i].class_id = HEATMAP_CLASS_ID_PERSON;
+        dets[i].confidence = 0.9f;
+      }
+      heatmap_source_accumulate (src, dets, PEOPLE_PER_FRAME);
+      /* The pipeline refreshes the overlay background every 30 frames. */
+      if (frame_number % 30 == 0)
+        heatmap_source_update_background (src, frame, -1);
+    }
+    frame_number++;
+    next += chrono::microseconds (1000000 / fps);
+    this_thread::sleep_until (next);
+  }
+}
+
+/* p in [0, 1] of sorted values. */
+static double
+percentile (const vector<double> &sorted, double p)
+{
+  if (sorted.empty ())
+    return 0;
+  return sorted[(size_t) (p * (sorted.size () - 1) + 0.5)];
+}
+
+static void
+print_latency (const char *name, vector<double> &latencies)
+{
+  sort (latencies.begin (), latencies.end ());
+  printf ("%-10s requests=%-7zu p50=%.2f p90=%.2f p99=%.2f max=%.2f ms\n",
+      name, latencies.size (), percentile (latencies, 0.5),
+      percentile (latencies, 0.9), percentile (latencies, 0.99),
+      latencies.empty () ? 0.0 : latencies.back ());
+}
+
+int
+main (int argc, char *argv[])
+{
+  int seconds = argc > 1 ? atoi (argv[1]) : 10;
+  int clients = argc > 2 ? atoi (argv[2]) : 8;
+  int num_sources = argc > 3 ? atoi (argv[3]) : 4;
+  int fps = argc > 4 ? atoi (argv[4]) : 30;
+  if (seconds <= 0 || clients <= 0 || num_sources <= 0 ||
+      num_sources > HEATMAP_MAX_SOURCES || fps <= 0) {
+    fprintf (stderr, "Usage: %s [seconds] [clients] [sources] [fps]\n", argv[0]);
+    return -1;
+  }
+
+  heatmap_engine_init (WIDTH, HEIGHT);
+  for (int s = 0; s < num_sources; s++)
+    heatmap_engine_get_source (s);
+
+  int port = heatmap_server_start ("127.0.0.1", 0);
+  if (port < 0)
+    return -1;
+
+  vector<ClientResult> results (clients);
+  thread producer (producer_loop, num_sources, fps);
+  vector<thread> threads;
+  auto start = chrono::steady_clock::now ();
+  for (int i = 0; i < clients; i++) {
+    results[i].completed = results[i].failed = 0;
+    threads.emplace_back (client_loop, port, num_sources, 1000 + i,
+        &results[i]);
+  }
+
+  this_thread::sleep_for (chrono::seconds (seconds));
+  done = true;
+  for (auto &t : threads)
+    t.join ();
+  producer.join ();
+  double elapsed = chrono::duration<double> (chrono::steady_clock::now () -
+      start).count ();
+  heatmap_server_stop ();
+
+  uint64_t completed = 0, failed = 0;
+  vector<double> all;
+  for (const ClientResult &r : results) {
+    completed += r.completed;
+    failed += r.failed;
+    all.insert (all.end (), r.latencies.begin (), r.latencies.end ());
+  }
+
+  HeatmapServerStats stats;
+  heatmap_server_get_stats (&stats);
+  uint64_t lookups = stats.cache_hits + stats.cache_misses;
+  printf ("clients=%d sources=%d fps=%d duration=%.1fs\n", clients,
+      num_sources, fps, elapsed);
+  printf ("requests ok=%llu failed=%llu rate=%.0f req/s\n",
+      (unsigned long long) completed, (unsigned long long) failed,
+      completed / elapsed);
+  printf ("image requests=%llu hits=%llu misses=%llu hit_rate=%.1f%% "
+      "encodes=%llu cache=%.1f MB\n", (unsigned long long) lookups,
+      (unsigned long long) stats.cache_hits,
+      (unsigned long long) stats.cache_misses,
+      lookups ? 100.0 * stats.cache_hits / lookups : 0.0,
+      (unsigned long long) stats.encodes, stats.cache_bytes / 1048576.0);
+  print_latency ("all", all);
+  for (int i = 0; i < clients; i++) {
+    char name[32];
+    snprintf (name, sizeof (name), "client %d", i);
+    print_latency (name, results[i].latencies);
+  }
+  return failed ? 1 : 0;
+}
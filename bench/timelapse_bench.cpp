@@ -0,0 +1,310 @@
+/*
+ * Benchmark of time-lapse export.
+ *
+ * Replays a synthetic day of one camera, open from 07:00 to 22:00 and empty
+ * at night, and exports one frame per minute:
+ *
+ *   offline  the tools/heatmap_timelapse path: blocking queue, renders only
+ *            when the heatmap changed. Reports the time for the whole day.
+ *   inline   the same frames rendered and encoded on the calling thread,
+ *            i.e. what a producer would wait for without the exporter.
+ *   live     a producer submitting frames back to back with each drop
+ *            policy, reporting the worst and mean time a submit takes and
+ *            how many frames were dropped.
+ *
+ * Writes JSON.
+ *
+ * Usage: timelapse_bench [-o results.json] [-f frames_per_minute]
+ *                        [-v video_dir] [-l label]
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "bench_common.h"
+#include "../heatmap_engine.h"
+#include "../heatmap_timelapse.h"
+#include "opencv2/highgui/highgui.hpp"
+
+#define WIDTH 1280
+#define HEIGHT 780
+#define PEOPLE 30
+#define MINUTES_PER_DAY 1440
+#define OPEN_MINUTE (7 * 60)
+#define CLOSE_MINUTE (22 * 60)
+#define LIVE_FRAMES 600
+#define LIVE_REPEATS 3
+
+struct LiveResult {
+  const char *policy;
+  double max_submit_ms;
+  double mean_submit_ms;
+  HeatmapTimelapseStats stats;
+};
+
+/* The day's detections; minute m ends at frames[minute_end[m]]. Night
+ * minutes have no frames. */
+struct Day {
+  HeatmapReplay replay;
+  std::vector<size_t> minute_end;
+};
+
+static void
+build_day (long frames_per_minute, Day *day)
+{
+  CrowdParams params;
+  params.pattern = CROWD_CORRIDORS;
+  params.width = WIDTH;
+  params.height = HEIGHT;
+  params.people = PEOPLE;
+  params.frames = frames_per_minute;
+  params.source_id = 0;
+  day->minute_end.resize (MINUTES_PER_DAY);
+  for (int m = 0; m < MINUTES_PER_DAY; m++) {
+    if (m >= OPEN_MINUTE && m < CLOSE_MINUTE) {
+      params.seed = m;
+      crowd_generate (params, &day->replay);
+    }
+    day->minute_end[m] = day->replay.frames.size ();
+  }
+}
+
+/* Accumulates minute m into src. */
+static void
+replay_minute (const Day &day, int m, HeatmapSource *src)
+{
+  size_t first = m ? day.minute_end[m - 1] : 0;
+  for (size_t f = first; f < day.minute_end[m]; f++) {
+    const HeatmapReplayFrame &frame = day.replay.frames[f];
+    heatmap_source_accumulate (src, day.replay.dets.data () + frame.first,
+        frame.count);
+  }
+}
+
+static HeatmapTimelapse *
+open_timelapse (const std::string &path, HeatmapTimelapseDrop drop)
+{
+  HeatmapTimelapseParams params;
+  heatmap_timelapse_default_params (&params, path.c_str (), WIDTH, HEIGHT);
+  params.drop = drop;
+  return heatmap_timelapse_open (&params);
+}
+
+static HeatmapRenderParams
+map_params (void)
+{
+  HeatmapRenderParams params;
+  params.mode = HEATMAP_RENDER_MAP;
+  params.colormap = cv::COLORMAP_JET;
+  params.alpha = 0.75;
+  params.window = cv::Rect ();
+  return params;
+}
+
+/* Both runs replay the day into their own source, so their times include
+ * accumulation and the canvas copies. */
+static bool
+run_offline (const Day &day, const std::string &path, double *ms,
+    HeatmapTimelapseStats *stats)
+{
+  static const cv::Mat unchanged;
+  HeatmapSource *src = heatmap_engine_get_source (0);
+  HeatmapRenderParams params = map_params ();
+  HeatmapRenderWorkspace ws;
+  heatmap_workspace_init (&ws, WIDTH, HEIGHT);
+  cv::Mat canvas;
+  uint64_t last_version = UINT64_MAX;
+  double start = bench_now_ms ();
+  HeatmapTimelapse *tl = open_timelapse (path, HEATMAP_TIMELAPSE_BLOCK);
+  if (!tl)
+    return false;
+  for (int m = 0; m < MINUTES_PER_DAY; m++) {
+    replay_minute (day, m, src);
+    uint64_t version = heatmap_source_version (src, HEATMAP_RENDER_MAP);
+    if (version == last_version) {
+      heatmap_timelapse_submit (tl, unchanged, version);
+      continue;
+    }
+    version = heatmap_source_snapshot (src, HEATMAP_RENDER_MAP, canvas, NULL);
+    heatmap_timelapse_submit (tl, heatmap_render (canvas, cv::Mat (), params,
+            &ws), version);
+    last_version = version;
+  }
+  heatmap_timelapse_close (tl, stats);
+  *ms = bench_now_ms () - start;
+  return true;
+}
+
+static bool
+run_inline (const Day &day, const std::string &path, double *ms)
+{
+  HeatmapSource *src = heatmap_engine_get_source (1);
+  HeatmapRenderParams params = map_params ();
+  HeatmapRenderWorkspace ws;
+  heatmap_workspace_init (&ws, WIDTH, HEIGHT);
+  cv::Mat canvas;
+  double start = bench_now_ms ();
+  cv::VideoWriter writer (path, cv::VideoWriter::fourcc ('M', 'J', 'P', 'G'),
+      HEATMAP_TIMELAPSE_DEFAULT_FPS, cv::Size (WIDTH, HEIGHT), true);
+  if (!writer.isOpened ())
+    return false;
+  for (int m = 0; m < MINUTES_PER_DAY; m++) {
+    replay_minute (day, m, src);
+    heatmap_source_snapshot (src, HEATMAP_RENDER_MAP, canvas, NULL);
+    writer.write (heatmap_render (canvas, cv::Mat (), params, &ws));
+  }
+  writer.release ();
+  *ms = bench_now_ms () - start;
+  return true;
+}
+
+/* Submits LIVE_FRAMES frames back to back, far faster than the encoder
+ * keeps up with, each version LIVE_REPEATS times so that dropping also
+ * discards repeats. Fails if the stats do not account for every frame. */
+static bool
+run_live (const cv::Mat &frame, const std::string &path, LiveResult *res,
+    HeatmapTimelapseDrop drop)
+{
+  HeatmapTimelapse *tl = open_timelapse (path, drop);
+  if (!tl)
+    return false;
+  double total = 0, worst = 0;
+  for (int i = 0; i < LIVE_FRAMES; i++) {
+    double start = bench_now_ms ();
+    heatmap_timelapse_submit (tl, frame, i / LIVE_REPEATS + 1);
+    double ms = bench_now_ms () - start;
+    total += ms;
+    worst = std::max (worst, ms);
+  }
+  heatmap_timelapse_close (tl, &res->stats);
+  res->max_submit_ms = worst;
+  res->mean_submit_ms = total / LIVE_FRAMES;
+  const HeatmapTimelapseStats &s = res->stats;
+  if (s.encoded + s.repeated + s.dropped != s.submitted) {
+    fprintf (stderr, "%s: %" PRIu64 " encoded + %" PRIu64 " repeated + %"
+        PRIu64 " dropped != %" PRIu64 " submitted\n", res->policy, s.encoded,
+        s.repeated, s.dropped, s.submitted);
+    return false;
+  }
+  return true;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *output = NULL;
+  const char *label = "";
+  const char *video_dir = NULL;
+  long frames_per_minute = 60;
+  int opt;
+  while ((opt = getopt (argc, argv, "o:f:v:l:")) != -1) {
+    switch (opt) {
+      case 'o':
+        output = optarg;
+        break;
+      case 'f':
+        frames_per_minute = atol (optarg);
+        break;
+      case 'v':
+        video_dir = optarg;
+        break;
+      case 'l':
+        label = optarg;
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-o results.json] [-f frames_per_minute] "
+            "[-v video_dir] [-l label]\n", argv[0]);
+        return -1;
+    }
+  }
+  if (frames_per_minute <= 0) {
+    fprintf (stderr, "invalid arguments\n");
+    return -1;
+  }
+
+  char dir[] = "/tmp/heatmap_timelapse_XXXXXX";
+  if (!video_dir) {
+    if (!mkdtemp (dir)) {
+      perror ("mkdtemp");
+      return -1;
+    }
+    video_dir = dir;
+  }
+  std::string base = std::string (video_dir) + "/";
+
+  heatmap_engine_init (WIDTH, HEIGHT);
+  Day day;
+  double start = bench_now_ms ();
+  build_day (frames_per_minute, &day);
+  fprintf (stderr, "generated %zu frames of detections in %.0f ms\n",
+      day.replay.frames.size (), bench_now_ms () - start);
+
+  double offline_ms, inline_ms;
+  HeatmapTimelapseStats offline;
+  if (!run_offline (day, base + "offline.avi", &offline_ms, &offline) ||
+      !run_inline (day, base + "inline.avi", &inline_ms)) {
+    fprintf (stderr, "cannot write videos to %s\n", video_dir);
+    return -1;
+  }
+  fprintf (stderr, "offline: %d frames in %.0f ms (%" PRIu64 " rendered, %"
+      PRIu64 " repeated); inline: %.0f ms\n", MINUTES_PER_DAY, offline_ms,
+      offline.encoded, offline.repeated, inline_ms);
+
+  HeatmapRenderParams params = map_params ();
+  HeatmapRenderWorkspace ws;
+  heatmap_workspace_init (&ws, WIDTH, HEIGHT);
+  cv::Mat canvas;
+  heatmap_source_snapshot (heatmap_engine_get_source (0), HEATMAP_RENDER_MAP,
+      canvas, NULL);
+  const cv::Mat &frame = heatmap_render (canvas, cv::Mat (), params, &ws);
+
+  LiveResult live[2];
+  live[0].policy = "drop_oldest";
+  live[1].policy = "drop_newest";
+  for (int i = 0; i < 2; i++) {
+    LiveResult &r = live[i];
+    if (!run_live (frame, base + r.policy + ".avi", &r, i ?
+            HEATMAP_TIMELAPSE_DROP_NEWEST : HEATMAP_TIMELAPSE_DROP_OLDEST))
+      return -1;
+    fprintf (stderr, "live %-11s submit max %.3f ms, mean %.3f ms; %" PRIu64
+        " of %d dropped\n", r.policy, r.max_submit_ms, r.mean_submit_ms,
+        r.stats.dropped, LIVE_FRAMES);
+  }
+
+  FILE *fp = output ? fopen (output, "w") : stdout;
+  if (!fp) {
+    perror (output);
+    return -1;
+  }
+  fprintf (fp, "{\n  \"benchmark\": \"timelapse\",\n  \"label\": \"%s\",\n"
+      "  \"width\": %d,\n  \"height\": %d,\n  \"minutes\": %d,\n"
+      "  \"offline_ms\": %.1f,\n  \"offline_rendered\": %" PRIu64 ",\n"
+      "  \"offline_repeated\": %" PRIu64 ",\n  \"inline_ms\": %.1f,\n"
+      "  \"live\": [\n", label, WIDTH, HEIGHT, MINUTES_PER_DAY, offline_ms,
+      offline.encoded, offline.repeated, inline_ms);
+  for (int i = 0; i < 2; i++) {
+    const LiveResult &r = live[i];
+    fprintf (fp, "    {\"policy\": \"%s\", \"frames\": %d, "
+        "\"max_submit_ms\": %.3f, \"mean_submit_ms\": %.3f, "
+        "\"encoded\": %" PRIu64 ", \"dropped\": %" PRIu64 "}%s\n", r.policy,
+        LIVE_FRAMES, r.max_submit_ms, r.mean_submit_ms, r.stats.encoded,
+        r.stats.dropped, i ? "" : ",");
+  }
+  fprintf (fp, "  ]\n}\n");
+  if (output)
+    fclose (fp);
+
+  if (video_dir == dir) {
+    std::string cmd = std::string ("rm -rf ") + dir;
+    if (system (cmd.c_str ()) != 0)
+      fprintf (stderr, "failed to remove %s\n", dir);
+  }
+  return 0;
+}
@@ -0,0 +1,351 @@
+/*
+ * Benchmark and accuracy check for detection weighting and per-frame
+ * footpoint de-duplication (footpoint_filter.h).
+ *
+ * Speed: times footpoint_filter_run against a pairwise suppression with the
+ * same result, from 10 to 1000 boxes per frame.
+ *
+ * Accuracy: synthetic crowds are corrupted the way a 0.1 pre-cluster
+ * threshold corrupts them (duplicate and spurious low-confidence boxes) and
+ * accumulated twice, unweighted and with the configured weighting. Both maps
+ * are compared with the map of the clean detections: the normalised L1
+ * distance (0 = same shape, 2 = disjoint) and the total mass relative to
+ * the clean map. Given a recorded detection log, which has no ground truth,
+ * the unweighted and weighted maps of the log are compared with each other
+ * instead, along with how many boxes were dropped or merged.
+ *
+ * Usage: weighting_bench [-o results.json] [-c heatmap_config.example.txt]
+ *                        [-f frames] [-l label] [detections.log]
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "bench_common.h"
+#include "../heatmap_config.h"
+#include "../heatmap_engine.h"
+
+#define WIDTH 1280
+#define HEIGHT 780
+#define ACCURACY_PEOPLE 50
+#define DUPLICATE_RATE 0.4f
+#define FALSE_POSITIVE_RATE 0.1f
+#define SPEED_FRAMES 200
+
+static const int box_counts[] = { 10, 50, 100, 250, 500, 1000 };
+#define NUM_BOX_COUNTS (int) (sizeof (box_counts) / sizeof (box_counts[0]))
+
+struct SpeedResult {
+  int boxes;
+  double hash_ns_per_box;
+  double pairwise_ns_per_box;
+  bool agree;
+};
+
+struct AccuracyResult {
+  const char *name;
+  size_t detections;
+  uint64_t zero_weight;
+  uint64_t duplicates;
+  /* Against the clean map, or the unweighted map for a recorded log. */
+  double l1_unweighted;
+  double l1_weighted;
+  double mass_unweighted;
+  double mass_weighted;
+};
+
+/* Reference O(n^2) suppression: a footpoint is kept unless an earlier kept
+ * one is within the radius, which is what the spatial hash computes. */
+static size_t
+pairwise_filter (const HeatmapWeighting *weighting,
+    const HeatmapDetection *dets, size_t num_dets,
+    std::vector<HeatmapFootpoint> &points)
+{
+  points.clear ();
+  float r2 = weighting->dedup_radius * weighting->dedup_radius;
+  for (size_t i = 0; i < num_dets; i++) {
+    float weight = heatmap_weighting_eval (weighting, dets[i].class_id,
+        dets[i].confidence);
+    if (weight <= 0)
+      continue;
+    HeatmapFootpoint point;
+    point.x = (int) (dets[i].left + dets[i].width / 2);
+    point.y = (int) (dets[i].top + dets[i].height);
+    point.weight = weight;
+    bool duplicate = false;
+    for (HeatmapFootpoint &kept : points) {
+      float dx = (float) (kept.x - point.x), dy = (float) (kept.y - point.y);
+      if (dx * dx + dy * dy <= r2) {
+        if (point.weight > kept.weight)
+          kept.weight = point.weight;
+        duplicate = true;
+        break;
+      }
+    }
+    if (!duplicate)
+      points.push_back (point);
+  }
+  return points.size ();
+}
+
+static void
+run_speed (const HeatmapWeighting *weighting, int boxes, SpeedResult *res)
+{
+  /* Boxes are split between people and their duplicates, at the density of
+   * a busy frame. */
+  HeatmapReplay clean, noisy;
+  CrowdParams params;
+  params.pattern = CROWD_UNIFORM;
+  params.width = WIDTH;
+  params.height = HEIGHT;
+  params.people = std::max (1, (int) (boxes / (1 + 1.5f * DUPLICATE_RATE)));
+  params.frames = SPEED_FRAMES;
+  params.source_id = 0;
+  params.seed = 99 + boxes;
+  crowd_generate (params, &clean);
+  crowd_add_detector_noise (clean, WIDTH, HEIGHT, DUPLICATE_RATE,
+      FALSE_POSITIVE_RATE, 5, &noisy);
+
+  FootpointFilter filter;
+  footpoint_filter_init (&filter, 2 * boxes);
+  std::vector<HeatmapFootpoint> reference;
+  reference.reserve (2 * boxes);
+
+  size_t total = noisy.dets.size ();
+  res->boxes = boxes;
+  res->agree = true;
+  double start = bench_now_ms ();
+  for (const HeatmapReplayFrame &frame : noisy.frames)
+    footpoint_filter_run (&filter, weighting, noisy.dets.data () + frame.first,
+        frame.count);
+  res->hash_ns_per_box = (bench_now_ms () - start) * 1e6 / total;
+
+  start = bench_now_ms ();
+  for (const HeatmapReplayFrame &frame : noisy.frames)
+    pairwise_filter (weighting, noisy.dets.data () + frame.first,
+        frame.count, reference);
+  res->pairwise_ns_per_box = (bench_now_ms () - start) * 1e6 / total;
+
+  /* Same suppression decisions, frame by frame. */
+  for (const HeatmapReplayFrame &frame : noisy.frames) {
+    const HeatmapDetection *dets = noisy.dets.data () + frame.first;
+    size_t n = footpoint_filter_run (&filter, weighting, dets, frame.count);
+    if (n != pairwise_filter (weighting, dets, frame.count, reference))
+      res->agree = false;
+  }
+}
+
+static void
+accumulate (unsigned int source_id, const HeatmapWeighting *weighting,
+    const HeatmapReplay &replay, uint64_t *zero_weight, uint64_t *duplicates)
+{
+  heatmap_engine_set_weighting (weighting);
+  HeatmapSource *src = heatmap_engine_get_source (source_id);
+  for (const HeatmapReplayFrame &frame : replay.frames)
+    heatmap_source_accumulate (src, replay.dets.data () + frame.first,
+        frame.count);
+  if (zero_weight)
+    *zero_weight = src->filter.zero_weight;
+  if (duplicates)
+    *duplicates = src->filter.duplicates;
+}
+
+static double
+canvas_sum (unsigned int source_id)
+{
+  return cv::sum (heatmap_engine_find_source (source_id)->canvas)[0];
+}
+
+/* Sum of |a / sum(a) - b / sum(b)| over all pixels. */
+static double
+normalized_l1 (unsigned int a_id, unsigned int b_id)
+{
+  const cv::Mat &a = heatmap_engine_find_source (a_id)->canvas;
+  const cv::Mat &b = heatmap_engine_find_source (b_id)->canvas;
+  double sa = canvas_sum (a_id), sb = canvas_sum (b_id);
+  if (sa == 0 || sb == 0)
+    return sa == sb ? 0 : 2;
+  double l1 = 0;
+  for (int y = 0; y < a.rows; y++) {
+    const uint16_t *ra = a.ptr<uint16_t> (y);
+    const uint16_t *rb = b.ptr<uint16_t> (y);
+    for (int x = 0; x < a.cols; x++)
+      l1 += fabs (ra[x] / sa - rb[x] / sb);
+  }
+  return l1;
+}
+
+static void
+run_accuracy (const HeatmapWeighting *weighting, CrowdPattern pattern,
+    long frames, unsigned int first_source, AccuracyResult *res)
+{
+  HeatmapReplay clean, noisy;
+  CrowdParams params;
+  params.pattern = pattern;
+  params.width = WIDTH;
+  params.height = HEIGHT;
+  params.people = ACCURACY_PEOPLE;
+  params.frames = frames;
+  params.source_id = 0;
+  params.seed = 4321 + pattern;
+  crowd_generate (params, &clean);
+  crowd_add_detector_noise (clean, WIDTH, HEIGHT, DUPLICATE_RATE,
+      FALSE_POSITIVE_RATE, 17 + pattern, &noisy);
+
+  HeatmapWeighting unweighted;
+  heatmap_weighting_default (&unweighted);
+  unsigned int truth = first_source, plain = first_source + 1,
+      weighted = first_source + 2;
+  accumulate (truth, &unweighted, clean, NULL, NULL);
+  accumulate (plain, &unweighted, noisy, NULL, NULL);
+  accumulate (weighted, weighting, noisy, &res->zero_weight,
+      &res->duplicates);
+
+  res->name = crowd_pattern_name (pattern);
+  res->detections = noisy.dets.size ();
+  res->l1_unweighted = normalized_l1 (plain, truth);
+  res->l1_weighted = normalized_l1 (weighted, truth);
+  res->mass_unweighted = canvas_sum (plain) / canvas_sum (truth);
+  res->mass_weighted = canvas_sum (weighted) / canvas_sum (truth);
+}
+
+static void
+run_log (const HeatmapWeighting *weighting, const HeatmapReplay &replay,
+    unsigned int first_source, AccuracyResult *res)
+{
+  HeatmapWeighting unweighted;
+  heatmap_weighting_default (&unweighted);
+  unsigned int plain = first_source, weighted = first_source + 1;
+  accumulate (plain, &unweighted, replay, NULL, NULL);
+  accumulate (weighted, weighting, replay, &res->zero_weight,
+      &res->duplicates);
+
+  res->name = "recorded";
+  res->detections = replay.dets.size ();
+  res->l1_unweighted = 0;
+  res->l1_weighted = normalized_l1 (weighted, plain);
+  res->mass_unweighted = 1;
+  res->mass_weighted = canvas_sum (plain) ?
+      canvas_sum (weighted) / canvas_sum (plain) : 0;
+}
+
+static void
+write_json (FILE *fp, const char *label, const HeatmapWeighting *weighting,
+    const std::vector<SpeedResult> &speed,
+    const std::vector<AccuracyResult> &accuracy)
+{
+  fprintf (fp, "{\n  \"benchmark\": \"weighting\",\n  \"label\": \"%s\",\n"
+      "  \"dedup_radius\": %.1f,\n  \"curve_points\": %d,\n"
+      "  \"speed\": [\n", label, weighting->dedup_radius,
+      weighting->num_curve_points);
+  for (size_t i = 0; i < speed.size (); i++) {
+    const SpeedResult &r = speed[i];
+    fprintf (fp, "    {\"boxes\": %d, \"hash_ns_per_box\": %.1f, "
+        "\"pairwise_ns_per_box\": %.1f, \"agree\": %s}%s\n", r.boxes,
+        r.hash_ns_per_box, r.pairwise_ns_per_box, r.agree ? "true" : "false",
+        i + 1 < speed.size () ? "," : "");
+  }
+  fprintf (fp, "  ],\n  \"accuracy\": [\n");
+  for (size_t i = 0; i < accuracy.size (); i++) {
+    const AccuracyResult &r = accuracy[i];
+    fprintf (fp, "    {\"input\": \"%s\", \"detections\": %zu, "
+        "\"zero_weight\": %llu, \"duplicates\": %llu, "
+        "\"l1_unweighted\": %.4f, \"l1_weighted\": %.4f, "
+        "\"mass_unweighted\": %.3f, \"mass_weighted\": %.3f}%s\n", r.name,
+        r.detections, (unsigned long long) r.zero_weight,
+        (unsigned long long) r.duplicates, r.l1_unweighted, r.l1_weighted,
+        r.mass_unweighted, r.mass_weighted,
+        i + 1 < accuracy.size () ? "," : "");
+  }
+  fprintf (fp, "  ]\n}\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *output = NULL;
+  const char *config_path = "heatmap_config.example.txt";
+  const char *label = "";
+  long frames = 900;
+  int opt;
+  while ((opt = getopt (argc, argv, "o:c:f:l:")) != -1) {
+    switch (opt) {
+      case 'o':
+        output = optarg;
+        break;
+      case 'c':
+        config_path = optarg;
+        break;
+      case 'f':
+        frames = atol (optarg);
+        break;
+      case 'l':
+        label = optarg;
+        break;
+      default:
+        fprintf (stderr, "Usage: %s [-o results.json] [-c config] "
+            "[-f frames] [-l label] [detections.log]\n", argv[0]);
+        return -1;
+    }
+  }
+  if (frames <= 0) {
+    fprintf (stderr, "invalid arguments\n");
+    return -1;
+  }
+
+  heatmap_engine_init (WIDTH, HEIGHT);
+  HeatmapConfig config;
+  heatmap_config_default (&config);
+  if (!heatmap_config_load (config_path, &config))
+    return -1;
+  const HeatmapWeighting *weighting = &config.weighting;
+
+  std::vector<SpeedResult> speed;
+  if (weighting->dedup_radius > 0) {
+    for (int i = 0; i < NUM_BOX_COUNTS; i++) {
+      SpeedResult res;
+      run_speed (weighting, box_counts[i], &res);
+      fprintf (stderr, "%5d boxes: hash %6.1f ns/box, pairwise %7.1f ns/box%s\n",
+          res.boxes, res.hash_ns_per_box, res.pairwise_ns_per_box,
+          res.agree ? "" : "  MISMATCH");
+      speed.push_back (res);
+    }
+  }
+
+  std::vector<AccuracyResult> accuracy;
+  if (optind < argc) {
+    HeatmapReplay replay;
+    if (!heatmap_replay_load (argv[optind], &replay))
+      return -1;
+    AccuracyResult res;
+    run_log (weighting, replay, 0, &res);
+    accuracy.push_back (res);
+  } else {
+    for (int p = 0; p < CROWD_NUM_PATTERNS; p++) {
+      AccuracyResult res;
+      run_accuracy (weighting, (CrowdPattern) p, frames, 3 * p, &res);
+      accuracy.push_back (res);
+    }
+  }
+  for (const AccuracyResult &r : accuracy)
+    fprintf (stderr, "%-10s L1 %.4f -> %.4f, mass %.2f -> %.2f, "
+        "%llu dropped, %llu merged\n", r.name, r.l1_unweighted, r.l1_weighted,
+        r.mass_unweighted, r.mass_weighted,
+        (unsigned long long) r.zero_weight,
+        (unsigned long long) r.duplicates);
+
+  FILE *fp = output ? fopen (output, "w") : stdout;
+  if (!fp) {
+    perror (output);
+    return -1;
+  }
+  write_json (fp, label, weighting, speed, accuracy);
+  if (output)
+    fclose (fp);
+  return 0;
+}
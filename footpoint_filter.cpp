@@ -0,0 +1,154 @@
+/*
+ * Per-frame footpoint weighting and duplicate suppression. See
+ * footpoint_filter.h.
+ */
+
+#include "footpoint_filter.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "heatmap_engine.h"
+
+void
+heatmap_weighting_default (HeatmapWeighting *weighting)
+{
+  memset (weighting, 0, sizeof (*weighting));
+  weighting->class_weights[HEATMAP_CLASS_ID_PERSON] = 1.0f;
+}
+
+float
+heatmap_weighting_eval (const HeatmapWeighting *weighting, int class_id,
+    float confidence)
+{
+  if (class_id < 0 || class_id >= HEATMAP_MAX_CLASSES)
+    return 0;
+  float weight = weighting->class_weights[class_id];
+  int n = weighting->num_curve_points;
+  if (weight == 0 || n == 0)
+    return weight;
+
+  const float *c = weighting->curve_confidence;
+  const float *w = weighting->curve_weight;
+  if (confidence <= c[0])
+    return weight * w[0];
+  for (int i = 1; i < n; i++) {
+    if (confidence <= c[i]) {
+      float t = (confidence - c[i - 1]) / (c[i] - c[i - 1]);
+      return weight * (w[i - 1] + t * (w[i] - w[i - 1]));
+    }
+  }
+  return weight * w[n - 1];
+}
+
+/* Sizes the scratch for capacity detections a frame, leaving the running
+ * totals alone. */
+static void
+reserve (FootpointFilter *filter, size_t capacity)
+{
+  /* Keep the hash table at most half full. */
+  size_t buckets = 16;
+  while (buckets < 2 * capacity)
+    buckets *= 2;
+  filter->points.reserve (capacity);
+  filter->next.reserve (capacity);
+  filter->bucket_head.assign (buckets, -1);
+  filter->bucket_generation.assign (buckets, 0);
+  filter->generation = 0;
+}
+
+void
+footpoint_filter_init (FootpointFilter *filter, size_t capacity)
+{
+  reserve (filter, capacity);
+  filter->detections = 0;
+  filter->zero_weight = 0;
+  filter->duplicates = 0;
+}
+
+static inline size_t
+cell_bucket (int cx, int cy, size_t mask)
+{
+  return ((uint32_t) cx * 73856093u ^ (uint32_t) cy * 19349663u) & mask;
+}
+
+size_t
+footpoint_filter_run (FootpointFilter *filter,
+    const HeatmapWeighting *weighting, const HeatmapDetection *dets,
+    size_t num_dets)
+{
+  filter->points.clear ();
+  filter->next.clear ();
+  filter->detections += num_dets;
+
+  const float radius = weighting->dedup_radius;
+  const bool dedup = radius > 0;
+  if (dedup && filter->bucket_head.size () < 2 * num_dets)
+    reserve (filter, num_dets);
+  if (dedup && ++filter->generation == 0) {
+    /* Wrapped around; stale entries could look current again. */
+    filter->bucket_generation.assign (filter->bucket_generation.size (), 0);
+    filter->generation = 1;
+  }
+  const size_t mask = filter->bucket_head.size () - 1;
+  const float r2 = radius * radius;
+
+  for (size_t i = 0; i < num_dets; i++) {
+    const HeatmapDetection *det = &dets[i];
+    float weight = heatmap_weighting_eval (weighting, det->class_id,
+        det->confidence);
+    if (weight <= 0) {
+      filter->zero_weight++;
+      continue;
+    }
+
+    HeatmapFootpoint point;
+    point.x = (int) (det->left + det->width / 2);
+    point.y = (int) (det->top + det->height);
+    point.weight = weight;
+    if (!dedup) {
+      filter->points.push_back (point);
+      continue;
+    }
+
+    /* Any duplicate lies in this cell or one of its eight neighbours. */
+    int cx = (int) floorf (point.x / radius);
+    int cy = (int) floorf (point.y / radius);
+    int match = -1;
+    for (int dy = -1; dy <= 1 && match < 0; dy++) {
+      for (int dx = -1; dx <= 1 && match < 0; dx++) {
+        size_t b = cell_bucket (cx + dx, cy + dy, mask);
+        if (filter->bucket_generation[b] != filter->generation)
+          continue;
+        for (int j = filter->bucket_head[b]; j >= 0; j = filter->next[j]) {
+          float ex = (float) (filter->points[j].x - point.x);
+          float ey = (float) (filter->points[j].y - point.y);
+          if (ex * ex + ey * ey <= r2) {
+            match = j;
+            break;
+          }
+        }
+      }
+    }
+
+    if (match >= 0) {
+      /* Keep the stronger box's weight; the kept footpoint stays where it
+       * was hashed, at most dedup_radius away. */
+      HeatmapFootpoint *kept = &filter->points[match];
+      if (point.weight > kept->weight)
+        kept->weight = point.weight;
+      filter->duplicates++;
+      continue;
+    }
+
+    size_t b = cell_bucket (cx, cy, mask);
+    if (filter->bucket_generation[b] != filter->generation) {
+      filter->bucket_generation[b] = filter->generation;
+      filter->bucket_head[b] = -1;
+    }
+    filter->next.push_back (filter->bucket_head[b]);
+    filter->bucket_head[b] = (int) filter->points.size ();
+    filter->points.push_back (point);
+  }
+  return filter->points.size ();
+}
@@ -0,0 +1,77 @@
+/*
+ * Per-frame footpoint stage that runs before accumulation.
+ *
+ * Turns detections into weighted footpoints (bottom centre of the box): the
+ * weight is a per-class factor times a piecewise-linear function of the
+ * detector confidence. With pre-cluster-threshold as low as 0.1, nvinfer
+ * emits several overlapping boxes for one person, so footpoints closer than
+ * dedup_radius are then collapsed into one, keeping the highest weight. The
+ * collapse uses a spatial hash with cells of dedup_radius, so a frame costs
+ * O(n) expected instead of the O(n^2) of pairwise NMS.
+ */
+
+#ifndef __FOOTPOINT_FILTER_H__
+#define __FOOTPOINT_FILTER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct HeatmapDetection;
+
+/* Matches num-detected-classes in the nvinfer config. */
+#define HEATMAP_MAX_CLASSES 80
+#define HEATMAP_MAX_CURVE_POINTS 8
+
+struct HeatmapWeighting {
+  /* Weight per class id; 0 leaves the class out of the heatmap. */
+  float class_weights[HEATMAP_MAX_CLASSES];
+  /* Confidence-to-weight curve, confidences ascending. Constant before the
+   * first and after the last point. No points means a weight of 1. */
+  int num_curve_points;
+  float curve_confidence[HEATMAP_MAX_CURVE_POINTS];
+  float curve_weight[HEATMAP_MAX_CURVE_POINTS];
+  /* Footpoints of one frame closer than this many pixels are duplicates.
+   * 0 disables suppression. */
+  float dedup_radius;
+};
+
+struct HeatmapFootpoint {
+  int x;
+  int y;
+  float weight;
+};
+
+/* Scratch for footpoint_filter_run. Sized by the largest frame seen, so
+ * steady-state frames reuse it without allocating. */
+struct FootpointFilter {
+  std::vector<HeatmapFootpoint> points;
+  std::vector<int> next;
+  std::vector<int> bucket_head;
+  /* bucket_head entries are valid only if their generation matches, which
+   * saves clearing the table every frame. */
+  std::vector<uint32_t> bucket_generation;
+  uint32_t generation;
+
+  /* Running totals, for benchmarks and diagnostics. */
+  uint64_t detections;
+  uint64_t zero_weight;
+  uint64_t duplicates;
+};
+
+/* Same behaviour as before weighting existed: persons count 1, everything
+ * else 0, no curve, no suppression. */
+void heatmap_weighting_default (HeatmapWeighting *weighting);
+
+float heatmap_weighting_eval (const HeatmapWeighting *weighting, int class_id,
+    float confidence);
+
+void footpoint_filter_init (FootpointFilter *filter, size_t capacity);
+
+/* Fills filter->points with the weighted, de-duplicated footpoints of dets
+ * and returns how many there are. */
+size_t footpoint_filter_run (FootpointFilter *filter,
+    const HeatmapWeighting *weighting, const HeatmapDetection *dets,
+    size_t num_dets);
+
+#endif
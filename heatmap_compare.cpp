@@ -0,0 +1,265 @@
+/*
+ * Comparison of two heatmaps. See heatmap_compare.h.
+ */
+
+#include "heatmap_compare.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "heatmap_engine.h"
+#include "heatmap_snapshot.h"
+#include "opencv2/core/hal/intrin.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+using namespace cv;
+using namespace std;
+
+void
+heatmap_compare_default_params (HeatmapCompareParams *params)
+{
+  params->normalize = true;
+  params->stamp_weight = HEATMAP_STAMP_WEIGHT;
+  params->ratio_epsilon = 0.1f;
+  params->threshold = 1.0f;
+  params->min_area = 50;
+  params->top_k = 10;
+}
+
+#if CV_SIMD
+/* Loads a vector's worth of counts widened to float. */
+static inline v_float32
+load_f32 (const uint16_t *p)
+{
+  return v_cvt_f32 (v_reinterpret_as_s32 (vx_load_expand (p)));
+}
+
+static inline v_float32
+load_f32 (const float *p)
+{
+  return vx_load (p);
+}
+#endif
+
+/* diff = b * sb - a * sa and ratio = (b * sb + eps) / (a * sa + eps) for one
+ * row, widening the counts to float in registers. Also tracks the range of
+ * diff. T is uint16_t for 16-bit canvases and float for everything else. */
+template <typename T>
+static void
+diff_ratio_row (const T *a, const T *b, int n, float sa, float sb, float eps,
+    float *diff, float *ratio, float *lo, float *hi)
+{
+  int x = 0;
+  float row_lo = *lo, row_hi = *hi;
+#if CV_SIMD
+  const int lanes = v_float32::nlanes;
+  if (n >= lanes) {
+    v_float32 vsa = vx_setall_f32 (sa), vsb = vx_setall_f32 (sb);
+    v_float32 veps = vx_setall_f32 (eps);
+    v_float32 vlo = vx_setall_f32 (row_lo), vhi = vx_setall_f32 (row_hi);
+    for (; x <= n - lanes; x += lanes) {
+      v_float32 fa = load_f32 (a + x) * vsa;
+      v_float32 fb = load_f32 (b + x) * vsb;
+      v_float32 d = fb - fa;
+      v_store (diff + x, d);
+      v_store (ratio + x, (fb + veps) / (fa + veps));
+      vlo = v_min (vlo, d);
+      vhi = v_max (vhi, d);
+    }
+    row_lo = v_reduce_min (vlo);
+    row_hi = v_reduce_max (vhi);
+  }
+  vx_cleanup ();
+#endif
+  for (; x < n; x++) {
+    float fa = a[x] * sa, fb = b[x] * sb;
+    float d = fb - fa;
+    diff[x] = d;
+    ratio[x] = (fb + eps) / (fa + eps);
+    row_lo = std::min (row_lo, d);
+    row_hi = std::max (row_hi, d);
+  }
+  *lo = row_lo;
+  *hi = row_hi;
+}
+
+/* Appends the connected regions of pixels changed by more than the
+ * threshold in one direction. */
+static void
+collect_regions (HeatmapComparison *result, const HeatmapCompareParams &params,
+    bool gains, vector<HeatmapRegion> &regions)
+{
+  if (gains)
+    compare (result->diff, params.threshold, result->mask, CMP_GT);
+  else
+    compare (result->diff, -params.threshold, result->mask, CMP_LT);
+  int n = connectedComponentsWithStats (result->mask, result->labels,
+      result->stats, result->centroids, 8, CV_32S);
+
+  /* Label 0 is the background. */
+  size_t first = regions.size ();
+  for (int l = 1; l < n; l++) {
+    const int *s = result->stats.ptr<int> (l);
+    HeatmapRegion region;
+    region.box = Rect (s[CC_STAT_LEFT], s[CC_STAT_TOP], s[CC_STAT_WIDTH],
+        s[CC_STAT_HEIGHT]);
+    region.area = s[CC_STAT_AREA];
+    region.change = 0;
+    region.peak = 0;
+    region.peak_at = Point (region.box.x, region.box.y);
+    regions.push_back (region);
+  }
+
+  for (int y = 0; y < result->labels.rows; y++) {
+    const int *label = result->labels.ptr<int> (y);
+    const float *d = result->diff.ptr<float> (y);
+    for (int x = 0; x < result->labels.cols; x++) {
+      if (!label[x])
+        continue;
+      HeatmapRegion &region = regions[first + label[x] - 1];
+      region.change += d[x];
+      if (fabsf (d[x]) > fabsf (region.peak)) {
+        region.peak = d[x];
+        region.peak_at = Point (x, y);
+      }
+    }
+  }
+}
+
+bool
+heatmap_compare_maps (const Mat &a, const Mat &b,
+    const HeatmapCompareParams &params, HeatmapComparison *result)
+{
+  if (a.channels () != 1 || b.channels () != 1 || a.size () != b.size () ||
+      !(params.stamp_weight > 0))
+    return false;
+
+  /* 16-bit pairs are widened in the kernel; anything else goes through
+   * float. */
+  bool wide = a.type () != CV_16UC1 || b.type () != CV_16UC1;
+  Mat fa, fb;
+  if (wide) {
+    a.convertTo (fa, CV_32F);
+    b.convertTo (fb, CV_32F);
+  }
+
+  float sa = 1.0f / params.stamp_weight, sb = sa;
+  if (params.normalize) {
+    double suma = sum (a)[0], sumb = sum (b)[0];
+    sa = suma > 0 ? (float) (a.total () / suma) : 0;
+    sb = sumb > 0 ? (float) (b.total () / sumb) : 0;
+  }
+
+  result->diff.create (a.size (), CV_32FC1);
+  result->ratio.create (a.size (), CV_32FC1);
+  float lo = 0, hi = 0;
+  for (int y = 0; y < a.rows; y++) {
+    if (wide)
+      diff_ratio_row (fa.ptr<float> (y), fb.ptr<float> (y), a.cols, sa, sb,
+          params.ratio_epsilon, result->diff.ptr<float> (y),
+          result->ratio.ptr<float> (y), &lo, &hi);
+    else
+      diff_ratio_row (a.ptr<uint16_t> (y), b.ptr<uint16_t> (y), a.cols, sa,
+          sb, params.ratio_epsilon, result->diff.ptr<float> (y),
+          result->ratio.ptr<float> (y), &lo, &hi);
+  }
+  result->diff_min = lo;
+  result->diff_max = hi;
+  return true;
+}
+
+void
+heatmap_compare_regions (const HeatmapCompareParams &params,
+    HeatmapComparison *result)
+{
+  vector<HeatmapRegion> &regions = result->regions;
+  regions.clear ();
+  collect_regions (result, params, true, regions);
+  collect_regions (result, params, false, regions);
+  regions.erase (std::remove_if (regions.begin (), regions.end (),
+          [&params] (const HeatmapRegion &r) {
+            return r.area < params.min_area;
+          }), regions.end ());
+  std::sort (regions.begin (), regions.end (),
+      [] (const HeatmapRegion &x, const HeatmapRegion &y) {
+        return fabs (x.change) > fabs (y.change);
+      });
+  if (params.top_k >= 0 && regions.size () > (size_t) params.top_k)
+    regions.resize (params.top_k);
+}
+
+bool
+heatmap_compare (const Mat &a, const Mat &b,
+    const HeatmapCompareParams &params, HeatmapComparison *result)
+{
+  if (!heatmap_compare_maps (a, b, params, result))
+    return false;
+  heatmap_compare_regions (params, result);
+  return true;
+}
+
+bool
+heatmap_compare_periods (const char *dir, unsigned int source_id,
+    int64_t a_from, int64_t a_to, int64_t b_from, int64_t b_to,
+    const HeatmapCompareParams &params, HeatmapComparison *result)
+{
+  Mat a, b;
+  return heatmap_snapshot_period (dir, source_id, a_from, a_to, a) &&
+      heatmap_snapshot_period (dir, source_id, b_from, b_to, b) &&
+      heatmap_compare (a, b, params, result);
+}
+
+/* 256-entry BGR blue-white-red table (ColorBrewer RdBu, reversed). */
+static const Mat &
+diverging_lut (void)
+{
+  static const Mat lut = [] {
+    static const float stops[5][3] = {
+      { 172, 102, 33 }, { 207, 169, 103 }, { 247, 247, 247 },
+      { 98, 138, 239 }, { 43, 24, 178 },
+    };
+    Mat table (1, 256, CV_8UC3);
+    for (int i = 0; i < 256; i++) {
+      float t = i * 4.0f / 255;
+      int s = std::min ((int) t, 3);
+      float f = t - s;
+      Vec3b &c = table.at<Vec3b> (0, i);
+      for (int k = 0; k < 3; k++)
+        c[k] = saturate_cast<uchar> (stops[s][k] +
+            f * (stops[s + 1][k] - stops[s][k]));
+    }
+    return table;
+  } ();
+  return lut;
+}
+
+/* Maps value v to 127.5 + v * scale and colours it. */
+static void
+render_diverging (const Mat &values, double scale, Mat &image)
+{
+  Mat gray, bgr;
+  values.convertTo (gray, CV_8UC1, scale, 127.5);
+  cvtColor (gray, bgr, COLOR_GRAY2BGR);
+  LUT (bgr, diverging_lut (), image);
+}
+
+void
+heatmap_render_diff (const Mat &diff, float range, Mat &image)
+{
+  if (range <= 0) {
+    double lo, hi;
+    minMaxLoc (diff, &lo, &hi);
+    range = (float) std::max (-lo, hi);
+  }
+  render_diverging (diff, range > 0 ? 127.5 / range : 0, image);
+}
+
+void
+heatmap_render_ratio (const Mat &ratio, float max_factor, Mat &image)
+{
+  Mat log_ratio;
+  log (ratio, log_ratio);
+  double range = max_factor > 1 ? log (max_factor) : log (2.0);
+  render_diverging (log_ratio, 127.5 / range, image);
+}
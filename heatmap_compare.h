@@ -0,0 +1,102 @@
+/*
+ * Comparison of two heatmaps, e.g. this week against last week or before
+ * against after a layout change.
+ *
+ * Each map is first normalised so its mean is 1, which compares where
+ * people went independently of how many came; a value of 2 is twice the
+ * average footfall of that period. The signed difference (b - a) and the
+ * ratio (b + eps) / (a + eps) are computed in one vectorised pass. Pixels
+ * whose difference exceeds the threshold are grouped into connected
+ * regions, separately for gains and losses, and the regions with the
+ * largest total change are reported.
+ */
+
+#ifndef __HEATMAP_COMPARE_H__
+#define __HEATMAP_COMPARE_H__
+
+#include <stdint.h>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+struct HeatmapCompareParams {
+  /* Normalise each map to a mean of 1. If false, values are in detections
+   * and absolute volumes are compared. */
+  bool normalize;
+  /* Canvas value of one detection (HeatmapGeometry::stamp_weight) in the
+   * maps compared; un-normalised values are divided by it. */
+  float stamp_weight;
+  /* Added to both maps before dividing, so empty areas give a ratio of 1
+   * instead of noise. */
+  float ratio_epsilon;
+  /* |b - a| above which a pixel counts as changed. */
+  float threshold;
+  /* Regions smaller than this many pixels are ignored. */
+  int min_area;
+  /* Number of regions to report. */
+  int top_k;
+};
+
+struct HeatmapRegion {
+  cv::Rect box;
+  int area;
+  /* Sum of b - a over the region: positive where b has more footfall. */
+  double change;
+  /* Largest |b - a| in the region, with its sign, and where it is. */
+  float peak;
+  cv::Point peak_at;
+};
+
+struct HeatmapComparison {
+  /* CV_32FC1 b - a and (b + eps) / (a + eps), after normalisation. */
+  cv::Mat diff;
+  cv::Mat ratio;
+  float diff_min;
+  float diff_max;
+  /* Largest |change| first, at most top_k. */
+  std::vector<HeatmapRegion> regions;
+
+  /* Scratch for region extraction, kept across calls. */
+  cv::Mat mask;
+  cv::Mat labels;
+  cv::Mat stats;
+  cv::Mat centroids;
+};
+
+/* threshold 1, ratio_epsilon 0.1, min_area 50, top_k 10, normalised, the
+ * default stamp weight. */
+void heatmap_compare_default_params (HeatmapCompareParams *params);
+
+/* Compares two single-channel canvases of the same size, of any accumulator
+ * type: heatmap_compare_maps followed by heatmap_compare_regions. Returns
+ * false if they are not, or if params.stamp_weight is not positive. */
+bool heatmap_compare (const cv::Mat &a, const cv::Mat &b,
+    const HeatmapCompareParams &params, HeatmapComparison *result);
+
+/* Fills diff, ratio and their range only. */
+bool heatmap_compare_maps (const cv::Mat &a, const cv::Mat &b,
+    const HeatmapCompareParams &params, HeatmapComparison *result);
+
+/* Re-extracts regions from result->diff, e.g. after changing the threshold,
+ * without recomputing the maps. */
+void heatmap_compare_regions (const HeatmapCompareParams &params,
+    HeatmapComparison *result);
+
+/* Compares the footfall of source_id in [a_from, a_to) with that in
+ * [b_from, b_to), using the snapshots in dir (see heatmap_snapshot.h).
+ * Returns false if either period has no data. */
+bool heatmap_compare_periods (const char *dir, unsigned int source_id,
+    int64_t a_from, int64_t a_to, int64_t b_from, int64_t b_to,
+    const HeatmapCompareParams &params, HeatmapComparison *result);
+
+/* Renders diff with a diverging colormap: blue where b is lower, white where
+ * unchanged, red where b is higher. range is the |diff| that saturates;
+ * 0 uses the largest magnitude in diff. */
+void heatmap_render_diff (const cv::Mat &diff, float range, cv::Mat &image);
+
+/* Same for a ratio map, on a log scale saturating at max_factor times more
+ * or less. */
+void heatmap_render_ratio (const cv::Mat &ratio, float max_factor,
+    cv::Mat &image);
+
+#endif
@@ -0,0 +1,211 @@
+/*
+ * Heatmap settings file. See heatmap_config.h.
+ */
+
+#include "heatmap_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void
+heatmap_config_default (HeatmapConfig *config)
+{
+  heatmap_weighting_default (&config->weighting);
+  heatmap_geometry_default (&config->geometry);
+}
+
+static char *
+strip (char *s)
+{
+  while (*s == ' ' || *s == '\t')
+    s++;
+  char *end = s + strlen (s);
+  while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' ||
+          end[-1] == '\r'))
+    *--end = '\0';
+  return s;
+}
+
+/* Parses "a:b;c:d;..." into at most max pairs. Returns the number of pairs,
+ * or -1 on a syntax error or too many pairs. */
+static int
+parse_pairs (const char *value, float *first, float *second, int max)
+{
+  int n = 0;
+  const char *p = value;
+  while (*p) {
+    char *end;
+    float a = strtof (p, &end);
+    if (end == p || *end != ':')
+      return -1;
+    p = end + 1;
+    float b = strtof (p, &end);
+    if (end == p || (*end && *end != ';') || n == max)
+      return -1;
+    first[n] = a;
+    second[n] = b;
+    n++;
+    p = *end ? end + 1 : end;
+  }
+  return n;
+}
+
+/* Returns false if value is invalid for key. Sets *known to whether key is
+ * a [weighting] key at all. */
+static bool
+set_weighting (HeatmapWeighting *w, const char *key, const char *value,
+    bool *known)
+{
+  *known = true;
+  if (!strcmp (key, "class-weights")) {
+    float ids[HEATMAP_MAX_CLASSES], weights[HEATMAP_MAX_CLASSES];
+    int n = parse_pairs (value, ids, weights, HEATMAP_MAX_CLASSES);
+    if (n < 0)
+      return false;
+    memset (w->class_weights, 0, sizeof (w->class_weights));
+    for (int i = 0; i < n; i++) {
+      int id = (int) ids[i];
+      if (id != ids[i] || id < 0 || id >= HEATMAP_MAX_CLASSES ||
+          weights[i] < 0)
+        return false;
+      w->class_weights[id] = weights[i];
+    }
+    return true;
+  }
+  if (!strcmp (key, "confidence-curve")) {
+    HeatmapWeighting curve = *w;
+    int n = parse_pairs (value, curve.curve_confidence, curve.curve_weight,
+        HEATMAP_MAX_CURVE_POINTS);
+    if (n < 0)
+      return false;
+    for (int i = 0; i < n; i++) {
+      if (curve.curve_weight[i] < 0 ||
+          (i && curve.curve_confidence[i] <= curve.curve_confidence[i - 1]))
+        return false;
+    }
+    curve.num_curve_points = n;
+    *w = curve;
+    return true;
+  }
+  if (!strcmp (key, "dedup-radius")) {
+    char *end;
+    float radius = strtof (value, &end);
+    if (end == value || *end || radius < 0)
+      return false;
+    w->dedup_radius = radius;
+    return true;
+  }
+  *known = false;
+  return true;
+}
+
+static bool
+parse_int (const char *value, int min, int max, int *out)
+{
+  char *end;
+  long v = strtol (value, &end, 10);
+  if (end == value || *end || v < min || v > max)
+    return false;
+  *out = (int) v;
+  return true;
+}
+
+/* Same contract as set_weighting, for [geometry]. */
+static bool
+set_geometry (HeatmapGeometry *g, const char *key, const char *value,
+    bool *known)
+{
+  *known = true;
+  if (!strcmp (key, "width"))
+    return parse_int (value, 1, 16384, &g->width);
+  if (!strcmp (key, "height"))
+    return parse_int (value, 1, 16384, &g->height);
+  if (!strcmp (key, "accumulator")) {
+    if (!strcmp (value, "uint16"))
+      g->accumulator = HEATMAP_ACCUMULATOR_UINT16;
+    else if (!strcmp (value, "int32"))
+      g->accumulator = HEATMAP_ACCUMULATOR_INT32;
+    else if (!strcmp (value, "float"))
+      g->accumulator = HEATMAP_ACCUMULATOR_FLOAT;
+    else
+      return false;
+    return true;
+  }
+  if (!strcmp (key, "stamp-shape")) {
+    if (!strcmp (value, "disc"))
+      g->stamp_shape = HEATMAP_STAMP_DISC;
+    else if (!strcmp (value, "square"))
+      g->stamp_shape = HEATMAP_STAMP_SQUARE;
+    else
+      return false;
+    return true;
+  }
+  if (!strcmp (key, "stamp-radius"))
+    return parse_int (value, 0, HEATMAP_STAMP_MAX_RADIUS, &g->stamp_radius);
+  if (!strcmp (key, "stamp-weight")) {
+    char *end;
+    float weight = strtof (value, &end);
+    if (end == value || *end || !(weight > 0))
+      return false;
+    g->stamp_weight = weight;
+    return true;
+  }
+  *known = false;
+  return true;
+}
+
+bool
+heatmap_config_load (const char *path, HeatmapConfig *config)
+{
+  FILE *fp = fopen (path, "r");
+  if (!fp) {
+    perror (path);
+    return false;
+  }
+
+  char line[1024];
+  char group[64] = "";
+  long line_number = 0;
+  bool ok = true;
+  while (ok && fgets (line, sizeof (line), fp)) {
+    line_number++;
+    char *s = strip (line);
+    if (*s == '#' || *s == '\0')
+      continue;
+
+    if (*s == '[') {
+      char *close = strchr (s, ']');
+      if (!close || close[1] != '\0' ||
+          (size_t) (close - s - 1) >= sizeof (group)) {
+        ok = false;
+        break;
+      }
+      *close = '\0';
+      strcpy (group, s + 1);
+      continue;
+    }
+
+    char *eq = strchr (s, '=');
+    if (!eq) {
+      ok = false;
+      break;
+    }
+    *eq = '\0';
+    char *key = strip (s);
+    char *value = strip (eq + 1);
+    bool known = false;
+    if (!strcmp (group, "weighting"))
+      ok = set_weighting (&config->weighting, key, value, &known);
+    else if (!strcmp (group, "geometry"))
+      ok = set_geometry (&config->geometry, key, value, &known);
+    if (!known)
+      fprintf (stderr, "%s:%ld: unknown key %s in [%s], ignored\n", path,
+          line_number, key, group);
+  }
+  fclose (fp);
+
+  if (!ok)
+    fprintf (stderr, "%s:%ld: invalid line\n", path, line_number);
+  return ok;
+}
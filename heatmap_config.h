@@ -0,0 +1,46 @@
+/*
+ * Heatmap settings file.
+ *
+ * A key-file in the style of the nvinfer configs:
+ *
+ *   [weighting]
+ *   # class-id:weight pairs; classes not listed get weight 0
+ *   class-weights=0:1.0
+ *   # confidence:weight points of a piecewise-linear curve
+ *   confidence-curve=0.1:0.2;0.5:1.0
+ *   # footpoints closer than this in one frame count once, in pixels
+ *   dedup-radius=8
+ *
+ *   [geometry]
+ *   # canvas size, also the stream muxer's output resolution
+ *   width=1920
+ *   height=1080
+ *   # uint16, int32 or float
+ *   accumulator=uint16
+ *   # disc or square; radius in pixels; value per detection of weight 1
+ *   stamp-shape=disc
+ *   stamp-radius=10
+ *   stamp-weight=5
+ *
+ * Everything is optional; missing keys keep their defaults.
+ */
+
+#ifndef __HEATMAP_CONFIG_H__
+#define __HEATMAP_CONFIG_H__
+
+#include "footpoint_filter.h"
+#include "heatmap_engine.h"
+
+struct HeatmapConfig {
+  HeatmapWeighting weighting;
+  HeatmapGeometry geometry;
+};
+
+void heatmap_config_default (HeatmapConfig *config);
+
+/* Reads path over the current contents of config. Returns false, after
+ * reporting the offending line on stderr, if the file cannot be read or a
+ * value does not parse. Unknown keys are reported and ignored. */
+bool heatmap_config_load (const char *path, HeatmapConfig *config);
+
+#endif
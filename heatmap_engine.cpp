@@ -0,0 +1,343 @@
+/*
+ * Heatmap engine: per-source footfall accumulators and rendering.
+ */
+
+#include "heatmap_engine.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "heatmap_kernels.h"
+#include "opencv2/imgproc/imgproc.hpp"
+
+using namespace cv;
+using namespace std;
+
+static HeatmapGeometry geometry = {
+  HEATMAP_DEFAULT_WIDTH, HEATMAP_DEFAULT_HEIGHT, HEATMAP_ACCUMULATOR_UINT16,
+  HEATMAP_STAMP_DISC, HEATMAP_STAMP_RADIUS, HEATMAP_STAMP_WEIGHT,
+};
+static HeatmapStamp stamp;
+/* Chosen once by heatmap_engine_init_geometry, see heatmap_kernels.h. */
+static const HeatmapKernels *kernels;
+
+static HeatmapWeighting
+default_weighting (void)
+{
+  HeatmapWeighting w;
+  heatmap_weighting_default (&w);
+  return w;
+}
+
+/* Independent of the geometry, so heatmap_engine_init_geometry keeps it. */
+static HeatmapWeighting weighting = default_weighting ();
+
+/* Room for a crowded frame, so the filter does not grow while streaming. */
+#define FILTER_INITIAL_CAPACITY 512
+
+/* Sources are created once and never freed, so readers can look them up
+ * without taking sources_lock. */
+static std::atomic<HeatmapSource *> sources[HEATMAP_MAX_SOURCES];
+static std::mutex sources_lock;
+
+/* 256-entry BGR tables for every OpenCV colormap, so rendering can use LUT()
+ * on preallocated images instead of applyColorMap(), which builds its table
+ * on every call. */
+#define NUM_COLORMAPS (COLORMAP_TURBO + 1)
+static Mat colormap_luts[NUM_COLORMAPS];
+
+void
+heatmap_geometry_default (HeatmapGeometry *g)
+{
+  g->width = HEATMAP_DEFAULT_WIDTH;
+  g->height = HEATMAP_DEFAULT_HEIGHT;
+  g->accumulator = HEATMAP_ACCUMULATOR_UINT16;
+  g->stamp_shape = HEATMAP_STAMP_DISC;
+  g->stamp_radius = HEATMAP_STAMP_RADIUS;
+  g->stamp_weight = HEATMAP_STAMP_WEIGHT;
+}
+
+int
+heatmap_accumulator_type (HeatmapAccumulator accumulator)
+{
+  switch (accumulator) {
+    case HEATMAP_ACCUMULATOR_INT32:
+      return CV_32SC1;
+    case HEATMAP_ACCUMULATOR_FLOAT:
+      return CV_32FC1;
+    default:
+      return CV_16UC1;
+  }
+}
+
+bool
+heatmap_engine_init_geometry (const HeatmapGeometry *g)
+{
+  if (g->width <= 0 || g->height <= 0 || g->stamp_radius < 0 ||
+      g->stamp_radius > HEATMAP_STAMP_MAX_RADIUS || !(g->stamp_weight > 0)) {
+    fprintf (stderr, "invalid heatmap geometry %dx%d, stamp radius %d, "
+        "weight %g\n", g->width, g->height, g->stamp_radius,
+        g->stamp_weight);
+    return false;
+  }
+  /* Existing canvases have the old size and type, which the new kernels
+   * would index out of bounds. Holding the lock keeps sources from being
+   * created halfway through the switch. */
+  std::lock_guard<std::mutex> guard (sources_lock);
+  for (unsigned int i = 0; i < HEATMAP_MAX_SOURCES; i++) {
+    if (sources[i].load (std::memory_order_relaxed)) {
+      fprintf (stderr, "heatmap geometry cannot change once sources "
+          "exist\n");
+      return false;
+    }
+  }
+  geometry = *g;
+  heatmap_stamp_init (&stamp, geometry.stamp_shape, geometry.stamp_radius,
+      geometry.stamp_weight);
+  kernels = heatmap_kernels_select (&geometry);
+
+  Mat ramp (1, 256, CV_8UC1);
+  for (int i = 0; i < 256; i++)
+    ramp.at<uchar> (0, i) = (uchar) i;
+  for (int i = 0; i < NUM_COLORMAPS; i++)
+    applyColorMap (ramp, colormap_luts[i], i);
+  return true;
+}
+
+bool
+heatmap_engine_init (int width, int height)
+{
+  HeatmapGeometry g;
+  heatmap_geometry_default (&g);
+  g.width = width;
+  g.height = height;
+  return heatmap_engine_init_geometry (&g);
+}
+
+const HeatmapGeometry *
+heatmap_engine_geometry (void)
+{
+  return &geometry;
+}
+
+const char *
+heatmap_engine_kernel_name (void)
+{
+  return kernels ? kernels->name : "none";
+}
+
+void
+heatmap_engine_set_weighting (const HeatmapWeighting *w)
+{
+  weighting = *w;
+}
+
+const HeatmapWeighting *
+heatmap_engine_weighting (void)
+{
+  return &weighting;
+}
+
+int
+heatmap_engine_width (void)
+{
+  return geometry.width;
+}
+
+int
+heatmap_engine_height (void)
+{
+  return geometry.height;
+}
+
+HeatmapSource *
+heatmap_engine_find_source (unsigned int source_id)
+{
+  if (source_id >= HEATMAP_MAX_SOURCES)
+    return NULL;
+  return sources[source_id].load (std::memory_order_acquire);
+}
+
+HeatmapSource *
+heatmap_engine_get_source (unsigned int source_id)
+{
+  HeatmapSource *src = heatmap_engine_find_source (source_id);
+  if (src || source_id >= HEATMAP_MAX_SOURCES)
+    return src;
+
+  std::lock_guard<std::mutex> guard (sources_lock);
+  src = sources[source_id].load (std::memory_order_relaxed);
+  if (!src) {
+    src = new HeatmapSource ();
+    src->source_id = source_id;
+    src->canvas = Mat::zeros (geometry.height, geometry.width,
+        heatmap_accumulator_type (geometry.accumulator));
+    src->background.create (geometry.height, geometry.width, CV_8UC3);
+    heatmap_workspace_init (&src->workspace, geometry.width, geometry.height);
+    footpoint_filter_init (&src->filter, FILTER_INITIAL_CAPACITY);
+    src->canvas_version = 0;
+    src->background_version = 0;
+    sources[source_id].store (src, std::memory_order_release);
+  }
+  return src;
+}
+
+unsigned int
+heatmap_engine_list_sources (unsigned int *ids, unsigned int max)
+{
+  unsigned int n = 0;
+  for (unsigned int i = 0; i < HEATMAP_MAX_SOURCES && n < max; i++) {
+    if (sources[i].load (std::memory_order_acquire))
+      ids[n++] = i;
+  }
+  return n;
+}
+
+void
+heatmap_source_accumulate (HeatmapSource *src, const HeatmapDetection *dets,
+    size_t num_dets)
+{
+  std::lock_guard<std::mutex> guard (src->lock);
+  size_t n = footpoint_filter_run (&src->filter, &weighting, dets, num_dets);
+  if (kernels->accumulate (src->canvas, src->filter.points.data (), n, stamp))
+    src->canvas_version++;
+}
+
+bool
+heatmap_source_restore (HeatmapSource *src, const Mat &canvas)
+{
+  std::lock_guard<std::mutex> guard (src->lock);
+  if (canvas.channels () != 1 || canvas.size () != src->canvas.size ())
+    return false;
+  canvas.convertTo (src->canvas, src->canvas.type ());
+  src->canvas_version++;
+  return true;
+}
+
+void
+heatmap_source_update_background (HeatmapSource *src, const Mat &frame,
+    int code)
+{
+  std::lock_guard<std::mutex> guard (src->lock);
+  if (code < 0)
+    frame.copyTo (src->background);
+  else
+    cvtColor (frame, src->background, code);
+  src->background_version++;
+}
+
+uint64_t
+heatmap_source_version (HeatmapSource *src, HeatmapRenderMode mode)
+{
+  /* Both counters only grow, so their sum changes whenever either does. */
+  uint64_t version = src->canvas_version.load ();
+  if (mode == HEATMAP_RENDER_OVERLAY)
+    version += src->background_version.load ();
+  return version;
+}
+
+uint64_t
+heatmap_source_snapshot (HeatmapSource *src, HeatmapRenderMode mode,
+    Mat &canvas, Mat *background)
+{
+  std::lock_guard<std::mutex> guard (src->lock);
+  src->canvas.copyTo (canvas);
+  if (background) {
+    /* The background is preallocated, so check whether one was ever
+     * stored. */
+    if (mode == HEATMAP_RENDER_OVERLAY && src->background_version.load ())
+      src->background.copyTo (*background);
+    else
+      background->release ();
+  }
+  return heatmap_source_version (src, mode);
+}
+
+void
+heatmap_workspace_init (HeatmapRenderWorkspace *ws, int width, int height)
+{
+  ws->temp.create (height, width, CV_8UC1);
+  ws->temp_bgr.create (height, width, CV_8UC3);
+  ws->im_color.create (height, width, CV_8UC3);
+  ws->res.create (height, width, CV_8UC3);
+}
+
+const Mat &
+heatmap_render (const Mat &canvas, const Mat &background,
+    const HeatmapRenderParams &params, HeatmapRenderWorkspace *ws)
+{
+  Rect full (0, 0, canvas.cols, canvas.rows);
+  Rect window = params.window.area () > 0 ? params.window & full : full;
+  int colormap = params.colormap >= 0 && params.colormap < NUM_COLORMAPS ?
+      params.colormap : COLORMAP_JET;
+
+  /* Same result as convertTo + applyColorMap, which also expands to BGR and
+   * looks each channel up in the colormap table. The kernels do it in one
+   * pass; other canvas types take the long way. */
+  Mat view = canvas (window);
+  HeatmapColorizeFn colorize = heatmap_kernels_colorize (kernels, view);
+  if (colorize) {
+    colorize (view, colormap_luts[colormap], ws->im_color);
+  } else {
+    view.convertTo (ws->temp, CV_8UC1);
+    cvtColor (ws->temp, ws->temp_bgr, COLOR_GRAY2BGR);
+    LUT (ws->temp_bgr, colormap_luts[colormap], ws->im_color);
+  }
+
+  if (params.mode == HEATMAP_RENDER_OVERLAY && !background.empty () &&
+      background.size () == canvas.size ()) {
+    addWeighted (background (window), params.alpha, ws->im_color,
+        1.0 - params.alpha, 0.0, ws->res);
+    return ws->res;
+  }
+  return ws->im_color;
+}
+
+const Mat &
+heatmap_source_render (HeatmapSource *src, const HeatmapRenderParams &params)
+{
+  static const Mat no_background;
+  std::lock_guard<std::mutex> guard (src->lock);
+  return heatmap_render (src->canvas,
+      src->background_version.load () ? src->background : no_background,
+      params, &src->workspace);
+}
+
+template <typename T, typename S>
+static void
+zone_sums (const Mat &canvas, int rows, int cols, S *sums)
+{
+  for (int y = 0; y < canvas.rows; y++) {
+    const T *row = canvas.ptr<T> (y);
+    S *zone_row = sums + (size_t) (y * rows / canvas.rows) * cols;
+    for (int x = 0; x < canvas.cols; x++)
+      zone_row[x * cols / canvas.cols] += row[x];
+  }
+}
+
+void
+heatmap_zone_counts (const Mat &canvas, int rows, int cols,
+    vector<uint64_t> &counts)
+{
+  counts.assign ((size_t) rows * cols, 0);
+  switch (canvas.type ()) {
+    case CV_16UC1:
+      zone_sums<uint16_t> (canvas, rows, cols, counts.data ());
+      break;
+    case CV_32SC1:
+      zone_sums<int32_t> (canvas, rows, cols, counts.data ());
+      break;
+    case CV_32FC1: {
+      /* Sum the fractions before rounding. */
+      vector<double> sums ((size_t) rows * cols, 0.0);
+      zone_sums<float> (canvas, rows, cols, sums.data ());
+      for (size_t i = 0; i < sums.size (); i++)
+        counts[i] = (uint64_t) llround (sums[i]);
+      break;
+    }
+    default:
+      break;
+  }
+}
@@ -0,0 +1,214 @@
+/*
+ * Heatmap engine: per-source footfall accumulators and the render step that
+ * turns them into colour-mapped images.
+ *
+ * Nothing in here depends on DeepStream, GStreamer or CUDA, so the same code
+ * runs inside the pipeline probes and in the standalone bench/ tools.
+ */
+
+#ifndef __HEATMAP_ENGINE_H__
+#define __HEATMAP_ENGINE_H__
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+#include "footpoint_filter.h"
+
+/* Upper bound on the number of sources the engine will track. */
+#define HEATMAP_MAX_SOURCES 64
+
+/* Class id of the detections that contribute to the heatmap. */
+#define HEATMAP_CLASS_ID_PERSON 0
+
+/* Default canvas size, the stream muxer's output resolution. */
+#define HEATMAP_DEFAULT_WIDTH 1280
+#define HEATMAP_DEFAULT_HEIGHT 780
+
+/* Default footpoint stamp: radius in pixels and the value added per
+ * detection of weight 1. */
+#define HEATMAP_STAMP_RADIUS 10
+#define HEATMAP_STAMP_WEIGHT 5
+
+/* Largest configurable stamp radius. */
+#define HEATMAP_STAMP_MAX_RADIUS 64
+
+/* Bounding box of one detection, in canvas (muxer output) coordinates. */
+struct HeatmapDetection {
+  float left;
+  float top;
+  float width;
+  float height;
+  int class_id;
+  float confidence;
+};
+
+enum HeatmapRenderMode {
+  /* Colour-mapped canvas only. */
+  HEATMAP_RENDER_MAP,
+  /* Colour-mapped canvas blended over the latest video frame. */
+  HEATMAP_RENDER_OVERLAY,
+};
+
+struct HeatmapRenderParams {
+  HeatmapRenderMode mode;
+  int colormap;
+  /* Weight of the video frame in overlay mode; the heatmap gets 1 - alpha. */
+  double alpha;
+  /* Region of the canvas to render. An empty rect means the whole canvas. */
+  cv::Rect window;
+};
+
+/* Element type of the accumulator canvas. */
+enum HeatmapAccumulator {
+  /* CV_16UC1, saturating at 65535. */
+  HEATMAP_ACCUMULATOR_UINT16,
+  /* CV_32SC1, saturating at INT32_MAX, for long unattended runs. OpenCV has
+   * no unsigned 32-bit type. */
+  HEATMAP_ACCUMULATOR_INT32,
+  /* CV_32FC1; keeps fractional detection weights instead of rounding them
+   * to steps of 1 / stamp_weight. */
+  HEATMAP_ACCUMULATOR_FLOAT,
+};
+
+enum HeatmapStampShape {
+  HEATMAP_STAMP_DISC,
+  HEATMAP_STAMP_SQUARE,
+};
+
+/* Canvas and stamp settings, fixed for the life of the process. */
+struct HeatmapGeometry {
+  int width;
+  int height;
+  HeatmapAccumulator accumulator;
+  HeatmapStampShape stamp_shape;
+  int stamp_radius;
+  /* Value added per detection of weight 1. */
+  float stamp_weight;
+};
+
+/* Scratch images for one render. Once sized for a given window they are
+ * reused as-is, so steady-state renders do not touch the heap. */
+struct HeatmapRenderWorkspace {
+  cv::Mat temp;
+  cv::Mat temp_bgr;
+  cv::Mat im_color;
+  cv::Mat res;
+};
+
+struct HeatmapSource {
+  unsigned int source_id;
+
+  /* Guards canvas, background and workspace. Versions are bumped while
+   * holding it. */
+  std::mutex lock;
+
+  /* Accumulated footfall, of the type the geometry's accumulator says. */
+  cv::Mat canvas;
+  /* Latest BGR video frame, refreshed at the render interval. */
+  cv::Mat background;
+  /* Full-canvas workspace for heatmap_source_render. */
+  HeatmapRenderWorkspace workspace;
+  /* Scratch for turning a frame's detections into footpoints. */
+  FootpointFilter filter;
+
+  /* Monotonic counters, bumped whenever canvas / background change. Readers
+   * use them to decide whether a previously rendered image is still valid. */
+  std::atomic<uint64_t> canvas_version;
+  std::atomic<uint64_t> background_version;
+};
+
+/* HEATMAP_DEFAULT_WIDTH x HEATMAP_DEFAULT_HEIGHT, 16-bit canvas, the
+ * default stamp. */
+void heatmap_geometry_default (HeatmapGeometry *geometry);
+
+/* Returns the CV_*C1 type of accumulator. */
+int heatmap_accumulator_type (HeatmapAccumulator accumulator);
+
+/* Sets the geometry used for sources created from now on, selects the
+ * accumulation and render kernels for it and builds the colormap tables.
+ * Must be called before the first heatmap_engine_get_source. Leaves the
+ * weighting as it is. Returns false, leaving the engine unchanged, if
+ * geometry is invalid or a source already exists. */
+bool heatmap_engine_init_geometry (const HeatmapGeometry *geometry);
+
+/* heatmap_engine_init_geometry with the default geometry resized to width x
+ * height. */
+bool heatmap_engine_init (int width, int height);
+
+const HeatmapGeometry *heatmap_engine_geometry (void);
+int heatmap_engine_width (void);
+int heatmap_engine_height (void);
+
+/* Name of the selected kernels, i.e. of the accumulator, e.g. "uint16". */
+const char *heatmap_engine_kernel_name (void);
+
+/* Returns the accumulator for source_id, creating it on first use. Creation
+ * preallocates the canvas, background and render workspace, so callers that
+ * want a heap-quiet streaming thread should create their sources up front.
+ * Returns NULL when source_id is out of range. */
+HeatmapSource *heatmap_engine_get_source (unsigned int source_id);
+
+/* Like heatmap_engine_get_source but never creates; NULL if unknown. */
+HeatmapSource *heatmap_engine_find_source (unsigned int source_id);
+
+/* Fills ids with the known source ids, returns how many were written. */
+unsigned int heatmap_engine_list_sources (unsigned int *ids, unsigned int max);
+
+/* Sets how detections are weighted and de-duplicated before they are
+ * stamped; see footpoint_filter.h. Defaults to heatmap_weighting_default.
+ * Call before streaming starts, accumulation does not lock it. */
+void heatmap_engine_set_weighting (const HeatmapWeighting *weighting);
+
+const HeatmapWeighting *heatmap_engine_weighting (void);
+
+/* Stamps the footpoint (bottom centre) of every detection with a non-zero
+ * weight, scaled by that weight, after suppressing duplicates. */
+void heatmap_source_accumulate (HeatmapSource *src,
+    const HeatmapDetection *dets, size_t num_dets);
+
+/* Replaces the canvas with canvas converted to the accumulator type, e.g.
+ * to resume from a persisted snapshot. Returns false on a size mismatch or
+ * if canvas is not single-channel. */
+bool heatmap_source_restore (HeatmapSource *src, const cv::Mat &canvas);
+
+/* Stores frame as the overlay background. code is the cv::cvtColor code that
+ * turns frame into BGR, or -1 if frame already is BGR. */
+void heatmap_source_update_background (HeatmapSource *src,
+    const cv::Mat &frame, int code);
+
+/* Version a render with the given mode depends on. */
+uint64_t heatmap_source_version (HeatmapSource *src, HeatmapRenderMode mode);
+
+/* Copies canvas (and background, if non-NULL) under the source lock and
+ * returns the version matching the copied data for the given mode. */
+uint64_t heatmap_source_snapshot (HeatmapSource *src, HeatmapRenderMode mode,
+    cv::Mat &canvas, cv::Mat *background);
+
+/* Sizes ws for renders of width x height windows. */
+void heatmap_workspace_init (HeatmapRenderWorkspace *ws, int width,
+    int height);
+
+/* Renders canvas, of any accumulator type, according to params using ws as
+ * scratch and returns the CV_8UC3 result, which lives in ws and is valid
+ * until its next render. background may be empty, in which case overlay
+ * mode falls back to the map. */
+const cv::Mat &heatmap_render (const cv::Mat &canvas,
+    const cv::Mat &background, const HeatmapRenderParams &params,
+    HeatmapRenderWorkspace *ws);
+
+/* Renders the source in place into its own workspace, without copying the
+ * canvas. The result is valid until the next heatmap_source_render call on
+ * the same source, so only one thread should use this per source. */
+const cv::Mat &heatmap_source_render (HeatmapSource *src,
+    const HeatmapRenderParams &params);
+
+/* Sums canvas over a rows x cols grid of equal zones, row-major. Sums of
+ * float canvases are rounded. */
+void heatmap_zone_counts (const cv::Mat &canvas, int rows, int cols,
+    std::vector<uint64_t> &counts);
+
+#endif
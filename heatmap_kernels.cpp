@@ -0,0 +1,198 @@
+/*
+ * Accumulation and render kernels. See heatmap_kernels.h.
+ */
+
+#include "heatmap_kernels.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+using namespace cv;
+
+/* How a footpoint weight becomes the value added to each stamped pixel, and
+ * how that addition saturates, per accumulator type. value() returns false
+ * for points that add nothing. */
+template <typename T> struct Accumulator;
+
+template <> struct Accumulator<uint16_t> {
+  typedef unsigned int Value;
+
+  static inline bool
+  value (float weight, float stamp_weight, Value *v)
+  {
+    /* The canvas is integral; weights round to the nearest step of
+     * 1 / stamp_weight and weights below half a step vanish. */
+    long r = lround (weight * stamp_weight);
+    if (r <= 0)
+      return false;
+    *v = (Value) std::min (r, 0xffffL);
+    return true;
+  }
+
+  static inline void
+  add (uint16_t &pixel, Value v)
+  {
+    unsigned int sum = pixel + v;
+    pixel = (uint16_t) (sum > 0xffff ? 0xffff : sum);
+  }
+};
+
+template <> struct Accumulator<int32_t> {
+  typedef int64_t Value;
+
+  static inline bool
+  value (float weight, float stamp_weight, Value *v)
+  {
+    long long r = llround (weight * stamp_weight);
+    if (r <= 0)
+      return false;
+    *v = std::min (r, (long long) INT32_MAX);
+    return true;
+  }
+
+  static inline void
+  add (int32_t &pixel, Value v)
+  {
+    int64_t sum = pixel + v;
+    pixel = (int32_t) (sum > INT32_MAX ? INT32_MAX : sum);
+  }
+};
+
+template <> struct Accumulator<float> {
+  typedef float Value;
+
+  static inline bool
+  value (float weight, float stamp_weight, Value *v)
+  {
+    *v = weight * stamp_weight;
+    return *v > 0;
+  }
+
+  static inline void
+  add (float &pixel, Value v)
+  {
+    pixel += v;
+  }
+};
+
+/* Each row of the stamp is clipped to the canvas, so points near or past
+ * an edge stamp only what falls inside. */
+template <typename T>
+static bool
+accumulate (Mat &canvas, const HeatmapFootpoint *points, size_t num_points,
+    const HeatmapStamp &stamp)
+{
+  typedef Accumulator<T> A;
+  const int r = stamp.radius;
+  bool changed = false;
+  for (size_t i = 0; i < num_points; i++) {
+    typename A::Value value;
+    if (!A::value (points[i].weight, stamp.weight, &value))
+      continue;
+    changed = true;
+    const int cx = points[i].x, cy = points[i].y;
+
+    const int y0 = std::max (cy - r, 0);
+    const int y1 = std::min (cy + r, canvas.rows - 1);
+    for (int y = y0; y <= y1; y++) {
+      const int span = stamp.span[y - cy + r];
+      const int x0 = std::max (cx - span, 0);
+      const int x1 = std::min (cx + span, canvas.cols - 1);
+      T *row = canvas.ptr<T> (y);
+      for (int x = x0; x <= x1; x++)
+        A::add (row[x], value);
+    }
+  }
+  return changed;
+}
+
+/* Same result as convertTo (CV_8U), cvtColor (GRAY2BGR) and LUT, without
+ * the two intermediate images. Each pixel is one 4-byte store of a packed
+ * table entry, the next pixel overwriting the spare byte. */
+template <typename T>
+static void
+colorize (const Mat &canvas, const Mat &lut, Mat &image)
+{
+  image.create (canvas.size (), CV_8UC3);
+  const uchar *table = lut.ptr ();
+  uint32_t packed[256];
+  for (int i = 0; i < 256; i++)
+    packed[i] = table[3 * i] | (table[3 * i + 1] << 8) |
+        (table[3 * i + 2] << 16);
+
+  const int width = canvas.cols;
+  if (width <= 0)
+    return;
+  for (int y = 0; y < canvas.rows; y++) {
+    const T *src = canvas.ptr<T> (y);
+    uchar *dst = image.ptr (y);
+    int x = 0;
+    for (; x < width - 1; x++)
+      memcpy (dst + 3 * x, &packed[saturate_cast<uchar> (src[x])], 4);
+    memcpy (dst + 3 * x, table + 3 * saturate_cast<uchar> (src[x]), 3);
+  }
+}
+
+static const HeatmapKernels all_kernels[] = {
+  { "uint16", CV_16UC1, accumulate<uint16_t>, colorize<uint16_t> },
+  { "int32", CV_32SC1, accumulate<int32_t>, colorize<int32_t> },
+  { "float", CV_32FC1, accumulate<float>, colorize<float> },
+};
+
+#define NUM_KERNELS (sizeof (all_kernels) / sizeof (all_kernels[0]))
+
+static const HeatmapKernels *
+kernels_for_type (int type)
+{
+  for (size_t i = 0; i < NUM_KERNELS; i++) {
+    if (all_kernels[i].type == type)
+      return &all_kernels[i];
+  }
+  return NULL;
+}
+
+void
+heatmap_stamp_init (HeatmapStamp *stamp, HeatmapStampShape shape, int radius,
+    float weight)
+{
+  stamp->radius = radius;
+  stamp->weight = weight;
+  const int size = 2 * radius + 1;
+  if (shape == HEATMAP_STAMP_SQUARE) {
+    for (int y = 0; y < size; y++)
+      stamp->span[y] = radius;
+    return;
+  }
+
+  /* Derived from circle() itself so the footprint is exactly what the old
+   * per-detection circle() + add produced. */
+  Mat disc = Mat::zeros (size, size, CV_8UC1);
+  circle (disc, Point (radius, radius), radius, 1, -1);
+  for (int y = 0; y < size; y++) {
+    const uchar *row = disc.ptr<uchar> (y);
+    int x = 0;
+    while (x < radius && !row[x])
+      x++;
+    stamp->span[y] = radius - x;
+  }
+}
+
+const HeatmapKernels *
+heatmap_kernels_select (const HeatmapGeometry *geometry)
+{
+  return kernels_for_type (heatmap_accumulator_type (geometry->accumulator));
+}
+
+HeatmapColorizeFn
+heatmap_kernels_colorize (const HeatmapKernels *kernels, const Mat &canvas)
+{
+  if (!kernels || canvas.type () != kernels->type)
+    kernels = kernels_for_type (canvas.type ());
+  return kernels ? kernels->colorize : NULL;
+}
@@ -0,0 +1,63 @@
+/*
+ * Accumulation and render kernels of the heatmap engine.
+ *
+ * The hot loops are templates over the accumulator type, instantiated for
+ * uint16, int32 and float; heatmap_kernels_select picks one once at
+ * startup, so frames go through without a switch on the canvas type.
+ * Stamping gives exactly what a per-detection circle() (or rectangle())
+ * and saturating add of the same value give, which kernel_bench checks.
+ *
+ * Radius and canvas size are read at run time. Kernels instantiated for
+ * fixed radii and canvas sizes ran at 0.8x to 1.7x the speed of these in
+ * kernel_bench, with no geometry consistently faster, so they were dropped.
+ */
+
+#ifndef __HEATMAP_KERNELS_H__
+#define __HEATMAP_KERNELS_H__
+
+#include <stddef.h>
+
+#include "opencv2/core/core.hpp"
+
+#include "footpoint_filter.h"
+#include "heatmap_engine.h"
+
+/* The footpoint disc or square as the half-width of each of its rows. */
+struct HeatmapStamp {
+  int radius;
+  int span[2 * HEATMAP_STAMP_MAX_RADIUS + 1];
+  float weight;
+};
+
+/* Adds the stamp, scaled by each point's weight, at each point. Returns
+ * whether the canvas changed. */
+typedef bool (*HeatmapAccumulateFn) (cv::Mat &canvas,
+    const HeatmapFootpoint *points, size_t num_points,
+    const HeatmapStamp &stamp);
+
+/* Colour-maps canvas through a 1x256 CV_8UC3 lut into image, in one pass;
+ * image is (re)allocated only if its size or type differ. */
+typedef void (*HeatmapColorizeFn) (const cv::Mat &canvas, const cv::Mat &lut,
+    cv::Mat &image);
+
+struct HeatmapKernels {
+  const char *name;
+  /* CV_*C1 type of the canvas. */
+  int type;
+  HeatmapAccumulateFn accumulate;
+  HeatmapColorizeFn colorize;
+};
+
+/* Builds the row spans of a stamp. */
+void heatmap_stamp_init (HeatmapStamp *stamp, HeatmapStampShape shape,
+    int radius, float weight);
+
+/* The kernels for geometry's accumulator. */
+const HeatmapKernels *heatmap_kernels_select (const HeatmapGeometry *geometry);
+
+/* Colorize kernel for canvas: that of kernels if they are for the canvas'
+ * type, else the one for its type. NULL for types no kernel handles. */
+HeatmapColorizeFn heatmap_kernels_colorize (const HeatmapKernels *kernels,
+    const cv::Mat &canvas);
+
+#endif
@@ -0,0 +1,182 @@
+/*
+ * Recording and replay of per-frame detections. See heatmap_replay.h.
+ */
+
+#include "heatmap_replay.h"
+
+#include <mutex>
+#include <utility>
+
+struct HeatmapRecorder {
+  FILE *fp;
+  size_t max_frames;
+  size_t max_dets;
+  /* Filled by heatmap_recorder_add; swapped with writing by the flush. */
+  HeatmapReplay pending;
+  HeatmapReplay writing;
+  uint64_t dropped;
+  std::mutex lock;
+};
+
+void
+heatmap_record_frame (FILE *fp, long frame_number, unsigned int source_id,
+    const HeatmapDetection *dets, size_t num_dets)
+{
+  fprintf (fp, "F %ld %u %zu\n", frame_number, source_id, num_dets);
+  for (size_t i = 0; i < num_dets; i++) {
+    fprintf (fp, "%d %.3f %.1f %.1f %.1f %.1f\n", dets[i].class_id,
+        dets[i].confidence, dets[i].left, dets[i].top, dets[i].width,
+        dets[i].height);
+  }
+}
+
+void
+heatmap_replay_append (HeatmapReplay *replay, long frame_number,
+    unsigned int source_id, const HeatmapDetection *dets, size_t num_dets)
+{
+  HeatmapReplayFrame frame;
+  frame.frame_number = frame_number;
+  frame.source_id = source_id;
+  frame.first = replay->dets.size ();
+  frame.count = num_dets;
+  replay->frames.push_back (frame);
+  replay->dets.insert (replay->dets.end (), dets, dets + num_dets);
+}
+
+bool
+heatmap_replay_load (const char *path, HeatmapReplay *replay)
+{
+  FILE *fp = fopen (path, "r");
+  if (!fp) {
+    perror (path);
+    return false;
+  }
+
+  replay->frames.clear ();
+  replay->dets.clear ();
+
+  char line[256];
+  long line_number = 0;
+  size_t pending = 0;
+  bool ok = true;
+  while (ok && fgets (line, sizeof (line), fp)) {
+    line_number++;
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+
+    if (line[0] == 'F') {
+      HeatmapReplayFrame frame;
+      if (pending ||
+          sscanf (line, "F %ld %u %zu", &frame.frame_number, &frame.source_id,
+              &frame.count) != 3) {
+        ok = false;
+        break;
+      }
+      frame.first = replay->dets.size ();
+      replay->frames.push_back (frame);
+      pending = frame.count;
+      continue;
+    }
+
+    HeatmapDetection det;
+    if (!pending ||
+        sscanf (line, "%d %f %f %f %f %f", &det.class_id, &det.confidence,
+            &det.left, &det.top, &det.width, &det.height) != 6) {
+      ok = false;
+      break;
+    }
+    replay->dets.push_back (det);
+    pending--;
+  }
+  fclose (fp);
+
+  if (!ok || pending) {
+    fprintf (stderr, "%s:%ld: malformed detection log\n", path, line_number);
+    return false;
+  }
+  return true;
+}
+
+bool
+heatmap_replay_save (const char *path, const HeatmapReplay &replay)
+{
+  FILE *fp = fopen (path, "w");
+  if (!fp) {
+    perror (path);
+    return false;
+  }
+  fprintf (fp, "# F <frame> <source> <count>, then "
+      "<class> <confidence> <left> <top> <width> <height>\n");
+  for (const HeatmapReplayFrame &frame : replay.frames) {
+    heatmap_record_frame (fp, frame.frame_number, frame.source_id,
+        replay.dets.data () + frame.first, frame.count);
+  }
+  return fclose (fp) == 0;
+}
+
+static void
+recorder_reserve (HeatmapReplay *replay, size_t max_frames, size_t max_dets)
+{
+  replay->frames.reserve (max_frames);
+  replay->dets.reserve (max_dets);
+}
+
+HeatmapRecorder *
+heatmap_recorder_open (const char *path, size_t max_frames, size_t max_dets)
+{
+  FILE *fp = fopen (path, "w");
+  if (!fp) {
+    perror (path);
+    return NULL;
+  }
+  HeatmapRecorder *rec = new HeatmapRecorder ();
+  rec->fp = fp;
+  rec->max_frames = max_frames;
+  rec->max_dets = max_dets;
+  rec->dropped = 0;
+  recorder_reserve (&rec->pending, max_frames, max_dets);
+  recorder_reserve (&rec->writing, max_frames, max_dets);
+  return rec;
+}
+
+void
+heatmap_recorder_add (HeatmapRecorder *rec, long frame_number,
+    unsigned int source_id, const HeatmapDetection *dets, size_t num_dets)
+{
+  std::lock_guard<std::mutex> guard (rec->lock);
+  HeatmapReplay *replay = &rec->pending;
+  if (replay->frames.size () >= rec->max_frames ||
+      replay->dets.size () + num_dets > rec->max_dets) {
+    rec->dropped++;
+    return;
+  }
+  heatmap_replay_append (replay, frame_number, source_id, dets, num_dets);
+}
+
+bool
+heatmap_recorder_flush (HeatmapRecorder *rec)
+{
+  {
+    std::lock_guard<std::mutex> guard (rec->lock);
+    std::swap (rec->pending, rec->writing);
+  }
+  HeatmapReplay *replay = &rec->writing;
+  for (const HeatmapReplayFrame &frame : replay->frames) {
+    heatmap_record_frame (rec->fp, frame.frame_number, frame.source_id,
+        replay->dets.data () + frame.first, frame.count);
+  }
+  replay->frames.clear ();
+  replay->dets.clear ();
+  return fflush (rec->fp) == 0;
+}
+
+bool
+heatmap_recorder_close (HeatmapRecorder *rec, uint64_t *dropped)
+{
+  bool ok = heatmap_recorder_flush (rec);
+  ok = fclose (rec->fp) == 0 && ok;
+  if (dropped)
+    *dropped = rec->dropped;
+  delete rec;
+  return ok;
+}
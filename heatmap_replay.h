@@ -0,0 +1,76 @@
+/*
+ * Recording and replay of per-frame detections.
+ *
+ * The pipeline can log the detections it feeds into the heatmap engine (set
+ * FOOTFALL_RECORD_DETECTIONS=<file>), and the bench/ tools replay such logs
+ * through the engine without DeepStream. The log is plain text, one block
+ * per frame:
+ *
+ *   F <frame_number> <source_id> <num_detections>
+ *   <class_id> <confidence> <left> <top> <width> <height>
+ *   ...
+ *
+ * Lines starting with '#' are comments.
+ */
+
+#ifndef __HEATMAP_REPLAY_H__
+#define __HEATMAP_REPLAY_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "heatmap_engine.h"
+
+struct HeatmapReplayFrame {
+  long frame_number;
+  unsigned int source_id;
+  /* Range of this frame's detections in HeatmapReplay::dets. */
+  size_t first;
+  size_t count;
+};
+
+/* A whole log held in memory; iterating over it does not allocate. */
+struct HeatmapReplay {
+  std::vector<HeatmapReplayFrame> frames;
+  std::vector<HeatmapDetection> dets;
+};
+
+/* Loads a detection log. Returns false (and prints why) on I/O or parse
+ * errors. */
+bool heatmap_replay_load (const char *path, HeatmapReplay *replay);
+
+/* Writes replay in the log format. */
+bool heatmap_replay_save (const char *path, const HeatmapReplay &replay);
+
+/* Appends one frame to an in-memory replay. */
+void heatmap_replay_append (HeatmapReplay *replay, long frame_number,
+    unsigned int source_id, const HeatmapDetection *dets, size_t num_dets);
+
+/* Writes one frame block to an open log. */
+void heatmap_record_frame (FILE *fp, long frame_number,
+    unsigned int source_id, const HeatmapDetection *dets, size_t num_dets);
+
+/* A log written in the background: the streaming thread only copies each
+ * frame into a preallocated buffer, and heatmap_recorder_flush, called
+ * periodically from elsewhere, formats and writes what has been queued. */
+struct HeatmapRecorder;
+
+/* Opens path for writing, with room for max_frames frames and max_dets
+ * detections between flushes. NULL (and prints why) on failure. */
+HeatmapRecorder *heatmap_recorder_open (const char *path, size_t max_frames,
+    size_t max_dets);
+
+/* Queues one frame. Never allocates or blocks on I/O; frames that do not
+ * fit before the next flush are dropped and counted. */
+void heatmap_recorder_add (HeatmapRecorder *rec, long frame_number,
+    unsigned int source_id, const HeatmapDetection *dets, size_t num_dets);
+
+/* Writes the queued frames. Returns false on write errors. */
+bool heatmap_recorder_flush (HeatmapRecorder *rec);
+
+/* Flushes, closes and frees rec. dropped, if not NULL, receives the number
+ * of frames that did not fit. */
+bool heatmap_recorder_close (HeatmapRecorder *rec, uint64_t *dropped);
+
+#endif
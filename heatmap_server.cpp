@@ -0,0 +1,869 @@
+/*
+ * Local HTTP query server for heatmap data. See heatmap_server.h.
+ */
+
+#include "heatmap_server.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "heatmap_engine.h"
+#include "occupancy_stats.h"
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+using namespace cv;
+using namespace std;
+
+#define MAX_REQUEST_HEAD 8192
+#define IDLE_TIMEOUT_SEC 5
+#define SEND_TIMEOUT_SEC 5
+#define MAX_CONNECTIONS 256
+#define MAX_ZONES_PER_AXIS 64
+
+typedef shared_ptr<const vector<uchar> > Body;
+
+/* Encoded images keyed by everything that affects their bytes except the
+ * accumulator version, which is stored alongside. A lookup with a newer
+ * version misses and the re-encoded image replaces the stale one, so each key
+ * holds at most one image and the cache never fills up with old versions. */
+class TileCache {
+public:
+  explicit TileCache (size_t capacity) : capacity (capacity), bytes (0) {}
+
+  Body lookup (const string &key, uint64_t version)
+  {
+    lock_guard<mutex> guard (lock);
+    auto it = entries.find (key);
+    if (it == entries.end () || it->second.version != version)
+      return Body ();
+    lru.splice (lru.begin (), lru, it->second.lru);
+    return it->second.data;
+  }
+
+  void insert (const string &key, uint64_t version, const Body &data)
+  {
+    lock_guard<mutex> guard (lock);
+    auto it = entries.find (key);
+    if (it != entries.end ()) {
+      /* A concurrent miss may already have stored a newer render. */
+      if (it->second.version > version)
+        return;
+      bytes -= it->second.data->size ();
+      lru.erase (it->second.lru);
+      entries.erase (it);
+    }
+    lru.push_front (key);
+    Entry entry = { version, data, lru.begin () };
+    entries.emplace (key, entry);
+    bytes += data->size ();
+
+    while (bytes > capacity && lru.size () > 1) {
+      auto victim = entries.find (lru.back ());
+      bytes -= victim->second.data->size ();
+      entries.erase (victim);
+      lru.pop_back ();
+    }
+  }
+
+  size_t size_bytes ()
+  {
+    lock_guard<mutex> guard (lock);
+    return bytes;
+  }
+
+private:
+  struct Entry {
+    uint64_t version;
+    Body data;
+    list<string>::iterator lru;
+  };
+
+  mutex lock;
+  unordered_map<string, Entry> entries;
+  list<string> lru;
+  size_t capacity;
+  size_t bytes;
+};
+
+struct Response {
+  int status;
+  const char *content_type;
+  Body body;
+  string headers;
+};
+
+static TileCache tile_cache (HEATMAP_SERVER_CACHE_BYTES);
+static std::atomic<uint64_t> stat_requests (0);
+static std::atomic<uint64_t> stat_hits (0);
+static std::atomic<uint64_t> stat_misses (0);
+static std::atomic<uint64_t> stat_encodes (0);
+
+/* A client connection. Owned by the poll loop while waiting for a request
+ * and by one worker while that request is served. */
+struct Connection {
+  int fd;
+  string buffer;
+  time_t last_active;
+};
+
+static int listen_fd = -1;
+static int wake_fds[2] = { -1, -1 };
+static std::atomic<bool> running (false);
+static std::atomic<int> num_connections (0);
+static thread poller;
+static vector<thread> workers;
+
+/* Connections with a complete request, for the workers, and served
+ * keep-alive connections going back to the poll loop. */
+static mutex queue_lock;
+static condition_variable queue_cond;
+static deque<Connection *> ready;
+static vector<Connection *> served;
+
+static Body
+make_body (const string &text)
+{
+  return make_shared<const vector<uchar> > (text.begin (), text.end ());
+}
+
+static void
+set_error (Response &resp, int status, const char *message)
+{
+  resp.status = status;
+  resp.content_type = "text/plain";
+  resp.body = make_body (string (message) + "\n");
+}
+
+static long
+query_long (const map<string, string> &query, const char *name, long def)
+{
+  auto it = query.find (name);
+  if (it == query.end () || it->second.empty ())
+    return def;
+  char *end = NULL;
+  long value = strtol (it->second.c_str (), &end, 10);
+  return *end ? def : value;
+}
+
+static double
+query_double (const map<string, string> &query, const char *name, double def)
+{
+  auto it = query.find (name);
+  if (it == query.end () || it->second.empty ())
+    return def;
+  char *end = NULL;
+  double value = strtod (it->second.c_str (), &end);
+  return *end ? def : value;
+}
+
+static string
+query_string (const map<string, string> &query, const char *name,
+    const char *def)
+{
+  auto it = query.find (name);
+  return it == query.end () ? string (def) : it->second;
+}
+
+static HeatmapSource *
+lookup_source (const map<string, string> &query, Response &resp)
+{
+  /* No default: the app's input is not source 0, so guessing one would
+   * only answer with the wrong camera or a 404. */
+  if (query.find ("source") == query.end ()) {
+    set_error (resp, 400, "source is required");
+    return NULL;
+  }
+  long id = query_long (query, "source", -1);
+  HeatmapSource *src = id < 0 ? NULL :
+      heatmap_engine_find_source ((unsigned int) id);
+  if (!src)
+    set_error (resp, 404, "unknown source");
+  return src;
+}
+
+static void
+handle_heatmap (const map<string, string> &query, Response &resp)
+{
+  HeatmapSource *src = lookup_source (query, resp);
+  if (!src)
+    return;
+
+  HeatmapRenderParams params;
+  string mode = query_string (query, "mode", "overlay");
+  if (mode == "overlay") {
+    params.mode = HEATMAP_RENDER_OVERLAY;
+  } else if (mode == "map") {
+    params.mode = HEATMAP_RENDER_MAP;
+  } else {
+    set_error (resp, 400, "mode must be map or overlay");
+    return;
+  }
+  params.colormap = (int) query_long (query, "colormap", COLORMAP_JET);
+  if (params.colormap < 0 || params.colormap > COLORMAP_TURBO) {
+    set_error (resp, 400, "colormap out of range");
+    return;
+  }
+  /* Quantise alpha so near-identical requests share a cache entry. */
+  long alpha_milli = lround (query_double (query, "alpha", 0.75) * 1000);
+  alpha_milli = alpha_milli < 0 ? 0 : (alpha_milli > 1000 ? 1000 : alpha_milli);
+  params.alpha = alpha_milli / 1000.0;
+
+  Rect full (0, 0, heatmap_engine_width (), heatmap_engine_height ());
+  params.window = Rect ((int) query_long (query, "x", 0),
+      (int) query_long (query, "y", 0),
+      (int) query_long (query, "w", full.width),
+      (int) query_long (query, "h", full.height)) & full;
+  if (params.window.area () <= 0) {
+    set_error (resp, 400, "empty window");
+    return;
+  }
+
+  string format = query_string (query, "format", "png");
+  const char *ext;
+  if (format == "png") {
+    ext = ".png";
+    resp.content_type = "image/png";
+  } else if (format == "jpg" || format == "jpeg") {
+    ext = ".jpg";
+    resp.content_type = "image/jpeg";
+  } else {
+    set_error (resp, 400, "format must be png or jpg");
+    return;
+  }
+
+  char key[160];
+  snprintf (key, sizeof (key), "%u/%d,%d,%d,%d/%d/%d/%ld%s", src->source_id,
+      params.window.x, params.window.y, params.window.width,
+      params.window.height, (int) params.mode, params.colormap, alpha_milli,
+      ext);
+
+  uint64_t version = heatmap_source_version (src, params.mode);
+  Body body = tile_cache.lookup (key, version);
+  if (body) {
+    stat_hits++;
+    resp.headers = "X-Cache: HIT\r\n";
+  } else {
+    stat_misses++;
+    /* Per-thread scratch keeps misses from reallocating full-size Mats. */
+    static thread_local Mat canvas, background;
+    static thread_local HeatmapRenderWorkspace workspace;
+    version = heatmap_source_snapshot (src, params.mode, canvas, &background);
+    const Mat &image = heatmap_render (canvas, background, params, &workspace);
+
+    auto encoded = make_shared<vector<uchar> > ();
+    if (!imencode (ext, image, *encoded)) {
+      set_error (resp, 500, "encode failed");
+      return;
+    }
+    stat_encodes++;
+    body = encoded;
+    tile_cache.insert (key, version, body);
+    resp.headers = "X-Cache: MISS\r\n";
+  }
+
+  resp.status = 200;
+  resp.body = body;
+  resp.headers += "X-Heatmap-Version: " + to_string (version) + "\r\n";
+}
+
+static void
+handle_grid (const map<string, string> &query, Response &resp)
+{
+  HeatmapSource *src = lookup_source (query, resp);
+  if (!src)
+    return;
+
+  Mat canvas;
+  uint64_t version = heatmap_source_snapshot (src, HEATMAP_RENDER_MAP, canvas,
+      NULL);
+  const uchar *data = canvas.ptr ();
+  resp.status = 200;
+  resp.content_type = "application/octet-stream";
+  resp.body = make_shared<const vector<uchar> > (data,
+      data + canvas.total () * canvas.elemSize ());
+  const char *type = canvas.type () == CV_32SC1 ? "int32" :
+      canvas.type () == CV_32FC1 ? "float32" : "uint16";
+  resp.headers = "X-Width: " + to_string (canvas.cols) + "\r\n" +
+      "X-Height: " + to_string (canvas.rows) + "\r\n" +
+      "X-Type: " + type + "\r\n" +
+      "X-Heatmap-Version: " + to_string (version) + "\r\n";
+}
+
+static void
+handle_zones (const map<string, string> &query, Response &resp)
+{
+  HeatmapSource *src = lookup_source (query, resp);
+  if (!src)
+    return;
+
+  long rows = query_long (query, "rows", 3);
+  long cols = query_long (query, "cols", 3);
+  if (rows < 1 || cols < 1 || rows > MAX_ZONES_PER_AXIS ||
+      cols > MAX_ZONES_PER_AXIS) {
+    set_error (resp, 400, "rows and cols must be in 1..64");
+    return;
+  }
+
+  Mat canvas;
+  uint64_t version = heatmap_source_snapshot (src, HEATMAP_RENDER_MAP, canvas,
+      NULL);
+  vector<uint64_t> counts;
+  heatmap_zone_counts (canvas, (int) rows, (int) cols, counts);
+
+  string json = "{\"source\":" + to_string (src->source_id) +
+      ",\"version\":" + to_string (version) +
+      ",\"rows\":" + to_string (rows) + ",\"cols\":" + to_string (cols) +
+      ",\"counts\":[";
+  for (size_t i = 0; i < counts.size (); i++) {
+    if (i)
+      json += ",";
+    json += to_string (counts[i]);
+  }
+  json += "]}";
+
+  resp.status = 200;
+  resp.content_type = "application/json";
+  resp.body = make_body (json);
+}
+
+static string
+summary_json (const OccupancySummary &summary)
+{
+  char json[384];
+  snprintf (json, sizeof (json),
+      "\"frames\":%llu,\"mean\":%.3f,\"min\":%u,\"max\":%u,"
+      "\"p50\":%.2f,\"p90\":%.2f,\"p99\":%.2f,\"peak_time\":%.3f",
+      (unsigned long long) summary.frames, summary.mean,
+      summary.frames ? summary.min : 0, summary.max, summary.p50,
+      summary.p90, summary.p99, summary.peak_time_us / 1e6);
+  return json;
+}
+
+/* /occupancy?source=N|all[&from=T&to=T][&intervals=1], times in Unix
+ * seconds. Without from/to the lifetime totals are returned. */
+static void
+handle_occupancy (const map<string, string> &query, Response &resp)
+{
+  string source = query_string (query, "source", "all");
+  unsigned int id = 0;
+  unsigned int num_sources = 0;
+  if (source != "all") {
+    long value = query_long (query, "source", -1);
+    if (value < 0 || value >= HEATMAP_MAX_SOURCES) {
+      set_error (resp, 404, "unknown source");
+      return;
+    }
+    id = (unsigned int) value;
+    num_sources = 1;
+  }
+  int64_t from_us = (int64_t) (query_double (query, "from", 0) * 1e6);
+  int64_t to_us = (int64_t) (query_double (query, "to", 0) * 1e6);
+  if (from_us && !to_us)
+    to_us = INT64_MAX;
+
+  OccupancySummary summary;
+  occupancy_query (&id, num_sources, from_us, to_us, &summary);
+  string json = "{\"source\":\"" + source + "\"," + summary_json (summary);
+  char averages[96];
+  snprintf (averages, sizeof (averages),
+      ",\"peak_source\":%u,\"ewma_short\":%.3f,\"ewma_long\":%.3f",
+      summary.peak_source, summary.ewma_short, summary.ewma_long);
+  json += averages;
+
+  if (num_sources == 1 && query_long (query, "intervals", 0)) {
+    vector<OccupancyInterval> intervals;
+    occupancy_list_intervals (id, intervals);
+    json += ",\"intervals\":[";
+    bool first = true;
+    for (const OccupancyInterval &interval : intervals) {
+      if (to_us && (interval.start_us < from_us || interval.start_us >= to_us))
+        continue;
+      OccupancySummary s;
+      occupancy_summarize (&interval.sketch, &s);
+      char start[32];
+      snprintf (start, sizeof (start), "%.0f", interval.start_us / 1e6);
+      json += string (first ? "" : ",") + "{\"start\":" + start + "," +
+          summary_json (s) + "}";
+      first = false;
+    }
+    json += "]";
+  }
+  json += "}";
+
+  resp.status = 200;
+  resp.content_type = "application/json";
+  resp.body = make_body (json);
+}
+
+static void
+handle_sources (Response &resp)
+{
+  unsigned int ids[HEATMAP_MAX_SOURCES];
+  unsigned int n = heatmap_engine_list_sources (ids, HEATMAP_MAX_SOURCES);
+  string json = "{\"width\":" + to_string (heatmap_engine_width ()) +
+      ",\"height\":" + to_string (heatmap_engine_height ()) +
+      ",\"sources\":[";
+  for (unsigned int i = 0; i < n; i++) {
+    HeatmapSource *src = heatmap_engine_find_source (ids[i]);
+    if (i)
+      json += ",";
+    json += "{\"id\":" + to_string (ids[i]) +
+        ",\"canvas_version\":" + to_string (src->canvas_version.load ()) +
+        ",\"background_version\":" +
+        to_string (src->background_version.load ()) + "}";
+  }
+  json += "]}";
+
+  resp.status = 200;
+  resp.content_type = "application/json";
+  resp.body = make_body (json);
+}
+
+static void
+handle_stats (Response &resp)
+{
+  HeatmapServerStats stats;
+  heatmap_server_get_stats (&stats);
+  char json[256];
+  snprintf (json, sizeof (json),
+      "{\"requests\":%llu,\"cache_hits\":%llu,\"cache_misses\":%llu,"
+      "\"encodes\":%llu,\"cache_bytes\":%llu}",
+      (unsigned long long) stats.requests,
+      (unsigned long long) stats.cache_hits,
+      (unsigned long long) stats.cache_misses,
+      (unsigned long long) stats.encodes,
+      (unsigned long long) stats.cache_bytes);
+  resp.status = 200;
+  resp.content_type = "application/json";
+  resp.body = make_body (json);
+}
+
+/* Parses the request head and fills resp. Returns whether the connection
+ * should be kept open afterwards. */
+static bool
+handle_request (const string &head, Response &resp)
+{
+  stat_requests++;
+
+  size_t line_end = head.find ("\r\n");
+  string line = head.substr (0, line_end);
+  size_t sp1 = line.find (' ');
+  size_t sp2 = line.rfind (' ');
+  if (sp1 == string::npos || sp2 == sp1) {
+    set_error (resp, 400, "bad request line");
+    return false;
+  }
+  string method = line.substr (0, sp1);
+  string target = line.substr (sp1 + 1, sp2 - sp1 - 1);
+  bool keep_alive = line.compare (sp2 + 1, string::npos, "HTTP/1.1") == 0;
+
+  /* Only the Connection header matters to us. */
+  for (size_t pos = line_end; pos != string::npos && pos < head.size ();) {
+    size_t next = head.find ("\r\n", pos + 2);
+    string header = head.substr (pos + 2,
+        next == string::npos ? string::npos : next - pos - 2);
+    if (strncasecmp (header.c_str (), "Connection:", 11) == 0) {
+      const char *value = header.c_str () + 11;
+      while (*value == ' ')
+        value++;
+      if (strcasecmp (value, "close") == 0)
+        keep_alive = false;
+      else if (strcasecmp (value, "keep-alive") == 0)
+        keep_alive = true;
+    }
+    pos = next;
+  }
+
+  if (method != "GET") {
+    set_error (resp, 405, "only GET is supported");
+    return keep_alive;
+  }
+
+  size_t qmark = target.find ('?');
+  string path = target.substr (0, qmark);
+  map<string, string> query;
+  if (qmark != string::npos) {
+    size_t pos = qmark + 1;
+    while (pos <= target.size ()) {
+      size_t amp = target.find ('&', pos);
+      if (amp == string::npos)
+        amp = target.size ();
+      string pair = target.substr (pos, amp - pos);
+      size_t eq = pair.find ('=');
+      if (!pair.empty ())
+        query[pair.substr (0, eq)] =
+            eq == string::npos ? string () : pair.substr (eq + 1);
+      pos = amp + 1;
+    }
+  }
+
+  if (path == "/heatmap")
+    handle_heatmap (query, resp);
+  else if (path == "/grid")
+    handle_grid (query, resp);
+  else if (path == "/zones")
+    handle_zones (query, resp);
+  else if (path == "/occupancy")
+    handle_occupancy (query, resp);
+  else if (path == "/sources")
+    handle_sources (resp);
+  else if (path == "/stats")
+    handle_stats (resp);
+  else
+    set_error (resp, 404, "not found");
+  return keep_alive;
+}
+
+static bool
+send_all (int fd, const void *data, size_t len)
+{
+  const char *p = (const char *) data;
+  while (len > 0) {
+    ssize_t n = send (fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static const char *
+status_text (int status)
+{
+  switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    default: return "Internal Server Error";
+  }
+}
+
+static bool
+send_response (int fd, const Response &resp, bool keep_alive)
+{
+  size_t len = resp.body ? resp.body->size () : 0;
+  char head[512];
+  int n = snprintf (head, sizeof (head),
+      "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+      "Connection: %s\r\n%s\r\n", resp.status, status_text (resp.status),
+      resp.content_type, len, keep_alive ? "keep-alive" : "close",
+      resp.headers.c_str ());
+  if (n < 0 || n >= (int) sizeof (head))
+    return false;
+  if (!send_all (fd, head, n))
+    return false;
+  return len == 0 || send_all (fd, resp.body->data (), len);
+}
+
+static void
+close_connection (Connection *conn)
+{
+  close (conn->fd);
+  delete conn;
+  num_connections--;
+}
+
+static bool
+has_request (const Connection *conn)
+{
+  return conn->buffer.find ("\r\n\r\n") != string::npos;
+}
+
+/* Answers the first buffered request of conn. Returns whether the
+ * connection stays open. */
+static bool
+serve_request (Connection *conn)
+{
+  size_t end = conn->buffer.find ("\r\n\r\n");
+  string head = conn->buffer.substr (0, end);
+  conn->buffer.erase (0, end + 4);
+
+  Response resp;
+  resp.status = 500;
+  resp.content_type = "text/plain";
+  bool keep_alive = handle_request (head, resp);
+  return send_response (conn->fd, resp, keep_alive) && keep_alive;
+}
+
+static void
+dispatch (Connection *conn)
+{
+  lock_guard<mutex> guard (queue_lock);
+  ready.push_back (conn);
+  queue_cond.notify_one ();
+}
+
+static void
+wake_poll_loop (void)
+{
+  char byte = 0;
+  while (write (wake_fds[1], &byte, 1) < 0 && errno == EINTR)
+    ;
+}
+
+/* Workers only ever see connections with a complete request buffered, so
+ * an idle keep-alive client or one trickling its request in never holds a
+ * worker; a slow reader holds one for at most SEND_TIMEOUT_SEC. */
+static void
+worker_loop (void)
+{
+  for (;;) {
+    Connection *conn;
+    {
+      unique_lock<mutex> guard (queue_lock);
+      queue_cond.wait (guard, [] { return !running || !ready.empty (); });
+      if (!running)
+        return;
+      conn = ready.front ();
+      ready.pop_front ();
+    }
+    if (!serve_request (conn)) {
+      close_connection (conn);
+      continue;
+    }
+    {
+      lock_guard<mutex> guard (queue_lock);
+      served.push_back (conn);
+    }
+    wake_poll_loop ();
+  }
+}
+
+static void
+accept_connections (vector<Connection *> &idle, time_t now)
+{
+  for (;;) {
+    int fd = accept (listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      return;
+    }
+    if (num_connections >= MAX_CONNECTIONS) {
+      close (fd);
+      continue;
+    }
+    struct timeval tv = { SEND_TIMEOUT_SEC, 0 };
+    setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+    int one = 1;
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+    Connection *conn = new Connection ();
+    conn->fd = fd;
+    conn->last_active = now;
+    num_connections++;
+    idle.push_back (conn);
+  }
+}
+
+/* Reads what conn has sent. Returns false if it closed, errored or sent an
+ * oversized request head. */
+static bool
+read_connection (Connection *conn)
+{
+  char chunk[4096];
+  for (;;) {
+    ssize_t n = recv (conn->fd, chunk, sizeof (chunk), MSG_DONTWAIT);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    if (n == 0)
+      return false;
+    conn->buffer.append (chunk, n);
+    if (conn->buffer.size () > MAX_REQUEST_HEAD && !has_request (conn))
+      return false;
+    if ((size_t) n < sizeof (chunk))
+      return true;
+  }
+}
+
+static time_t
+monotonic_seconds (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+/* Owns every connection that is not being served: accepts new ones, reads
+ * request heads and hands complete ones to the workers, and closes
+ * connections idle for IDLE_TIMEOUT_SEC. */
+static void
+poll_loop (void)
+{
+  vector<Connection *> idle;
+  vector<struct pollfd> fds;
+  while (running) {
+    fds.resize (idle.size () + 2);
+    fds[0].fd = listen_fd;
+    fds[1].fd = wake_fds[0];
+    for (size_t i = 0; i < idle.size (); i++)
+      fds[i + 2].fd = idle[i]->fd;
+    for (struct pollfd &p : fds) {
+      p.events = POLLIN;
+      p.revents = 0;
+    }
+    if (poll (fds.data (), fds.size (), 1000) < 0 && errno != EINTR)
+      break;
+    time_t now = monotonic_seconds ();
+
+    /* Walks the connections polled above; the ones accepted or returned
+     * below are appended after them. */
+    size_t polled = idle.size (), kept = 0;
+    for (size_t i = 0; i < polled; i++) {
+      Connection *conn = idle[i];
+      if (fds[i + 2].revents) {
+        if (!read_connection (conn)) {
+          close_connection (conn);
+          continue;
+        }
+        conn->last_active = now;
+        if (has_request (conn)) {
+          dispatch (conn);
+          continue;
+        }
+      } else if (now - conn->last_active >= IDLE_TIMEOUT_SEC) {
+        close_connection (conn);
+        continue;
+      }
+      idle[kept++] = conn;
+    }
+    idle.resize (kept);
+
+    if (fds[0].revents)
+      accept_connections (idle, now);
+    if (fds[1].revents) {
+      char drain[64];
+      while (read (wake_fds[0], drain, sizeof (drain)) > 0)
+        ;
+      vector<Connection *> returned;
+      {
+        lock_guard<mutex> guard (queue_lock);
+        returned.swap (served);
+      }
+      /* A pipelined request may already be buffered. */
+      for (Connection *conn : returned) {
+        conn->last_active = now;
+        if (has_request (conn))
+          dispatch (conn);
+        else
+          idle.push_back (conn);
+      }
+    }
+  }
+  for (Connection *conn : idle)
+    close_connection (conn);
+}
+
+int
+heatmap_server_start (const char *addr, int port)
+{
+  if (running)
+    return -1;
+
+  struct sockaddr_in sa;
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  if (inet_pton (AF_INET, addr, &sa.sin_addr) != 1) {
+    fprintf (stderr, "heatmap server: bad address %s\n", addr);
+    return -1;
+  }
+
+  listen_fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    perror ("heatmap server: socket");
+    return -1;
+  }
+  int one = 1;
+  setsockopt (listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+  if (bind (listen_fd, (struct sockaddr *) &sa, sizeof (sa)) < 0 ||
+      listen (listen_fd, 64) < 0) {
+    perror ("heatmap server: bind");
+    close (listen_fd);
+    listen_fd = -1;
+    return -1;
+  }
+  if (pipe2 (wake_fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+    perror ("heatmap server: pipe");
+    close (listen_fd);
+    listen_fd = -1;
+    return -1;
+  }
+  fcntl (listen_fd, F_SETFL, fcntl (listen_fd, F_GETFL) | O_NONBLOCK);
+
+  socklen_t len = sizeof (sa);
+  getsockname (listen_fd, (struct sockaddr *) &sa, &len);
+
+  running = true;
+  for (int i = 0; i < HEATMAP_SERVER_WORKERS; i++)
+    workers.emplace_back (worker_loop);
+  poller = thread (poll_loop);
+  return ntohs (sa.sin_port);
+}
+
+void
+heatmap_server_stop (void)
+{
+  if (!running)
+    return;
+  {
+    lock_guard<mutex> guard (queue_lock);
+    running = false;
+    queue_cond.notify_all ();
+  }
+  wake_poll_loop ();
+  poller.join ();
+  for (auto &worker : workers)
+    worker.join ();
+  workers.clear ();
+  /* Connections the workers handed back or never picked up. */
+  for (Connection *conn : ready)
+    close_connection (conn);
+  for (Connection *conn : served)
+    close_connection (conn);
+  ready.clear ();
+  served.clear ();
+  close (wake_fds[0]);
+  close (wake_fds[1]);
+  close (listen_fd);
+  listen_fd = -1;
+}
+
+void
+heatmap_server_get_stats (HeatmapServerStats *stats)
+{
+  stats->requests = stat_requests;
+  stats->cache_hits = stat_hits;
+  stats->cache_misses = stat_misses;
+  stats->encodes = stat_encodes;
+  stats->cache_bytes = tile_cache.size_bytes ();
+}
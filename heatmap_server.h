@@ -0,0 +1,60 @@
+/*
+ * Local HTTP query server for heatmap data.
+ *
+ * Serves per-source heatmap images, raw accumulator grids and zone counts on
+ * demand. Encoded images are cached keyed by (source, window, render params)
+ * and tagged with the accumulator version they were rendered from, so an
+ * image is only encoded when a client asks for it and the data has changed.
+ *
+ * One thread polls all connections and hands each complete request to a
+ * small pool of workers, so an idle keep-alive client holds no worker and
+ * up to 256 connections are served in turn.
+ *
+ * Endpoints (all GET):
+ *   /sources                  JSON list of sources and their versions
+ *   /heatmap?source=N[&mode=map|overlay][&colormap=N][&alpha=F]
+ *           [&format=png|jpg][&x=&y=&w=&h=]
+ *                             encoded heatmap image
+ *   /grid?source=N            raw canvas, little endian, row-major; size in
+ *                             X-Width / X-Height, element type (uint16,
+ *                             int32 or float32) in X-Type headers
+ *   /zones?source=N[&rows=R][&cols=C]
+ *                             JSON per-zone sums over an R x C grid
+ *   /occupancy?source=N|all[&from=T&to=T][&intervals=1]
+ *                             JSON people-per-frame statistics, see
+ *                             occupancy_stats.h; times in Unix seconds
+ *   /stats                    JSON server and cache counters
+ *
+ * source is required where it takes N; requests without it get a 400. The
+ * app's input is source 1 (streammux sink_1).
+ */
+
+#ifndef __HEATMAP_SERVER_H__
+#define __HEATMAP_SERVER_H__
+
+#include <stdint.h>
+
+#define HEATMAP_SERVER_DEFAULT_PORT 8090
+/* Threads rendering and sending responses. */
+#define HEATMAP_SERVER_WORKERS 4
+
+/* Upper bound on the memory held by encoded images. */
+#define HEATMAP_SERVER_CACHE_BYTES (32 * 1024 * 1024)
+
+struct HeatmapServerStats {
+  uint64_t requests;
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  uint64_t encodes;
+  uint64_t cache_bytes;
+};
+
+/* Starts the server on addr:port (port 0 picks a free port). Returns the
+ * bound port, or -1 on failure. Only one server runs per process. */
+int heatmap_server_start (const char *addr, int port);
+
+void heatmap_server_stop (void);
+
+void heatmap_server_get_stats (HeatmapServerStats *stats);
+
+#endif
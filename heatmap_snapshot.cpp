@@ -0,0 +1,192 @@
+/*
+ * Persisted accumulator snapshots. See heatmap_snapshot.h.
+ */
+
+#include "heatmap_snapshot.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include "opencv2/highgui/highgui.hpp"
+
+using namespace cv;
+using namespace std;
+
+/* Parses a decimal number that makes up all of s up to suffix. */
+static bool
+parse_name (const char *s, const char *suffix, long long *value)
+{
+  char *end;
+  errno = 0;
+  *value = strtoll (s, &end, 10);
+  return end != s && !errno && *value >= 0 && strcmp (end, suffix) == 0;
+}
+
+static bool
+make_dir (const string &path)
+{
+  if (mkdir (path.c_str (), 0755) == 0 || errno == EEXIST)
+    return true;
+  perror (path.c_str ());
+  return false;
+}
+
+bool
+heatmap_snapshot_save (const char *dir, unsigned int source_id, int64_t time,
+    const Mat &canvas)
+{
+  string source_dir = string (dir) + "/" + to_string (source_id);
+  if (!make_dir (dir) || !make_dir (source_dir))
+    return false;
+
+  /* 16-bit canvases go to PNG; int32 and float ones to TIFF, which keeps
+   * both types as they are. */
+  const char *ext;
+  vector<int> params;
+  switch (canvas.type ()) {
+    case CV_16UC1:
+      ext = ".png";
+      params = { IMWRITE_PNG_COMPRESSION, 1 };
+      break;
+    case CV_32SC1:
+    case CV_32FC1:
+      ext = ".tiff";
+      break;
+    default:
+      fprintf (stderr, "Cannot snapshot canvases of type %d\n",
+          canvas.type ());
+      return false;
+  }
+
+  /* imwrite picks the format from the extension, so the temporary name has
+   * to end in it too; listing ignores it as it is not a bare number. */
+  string name = source_dir + "/" + to_string ((long long) time);
+  string path = name + ext;
+  string tmp = name + ".tmp" + ext;
+  if (!imwrite (tmp, canvas, params)) {
+    fprintf (stderr, "Failed to write %s\n", tmp.c_str ());
+    return false;
+  }
+  if (rename (tmp.c_str (), path.c_str ()) != 0) {
+    perror (path.c_str ());
+    remove (tmp.c_str ());
+    return false;
+  }
+  return true;
+}
+
+bool
+heatmap_snapshot_load (const char *path, Mat &canvas)
+{
+  canvas = imread (path, IMREAD_UNCHANGED);
+  if (canvas.empty () || (canvas.type () != CV_16UC1 &&
+          canvas.type () != CV_32SC1 && canvas.type () != CV_32FC1)) {
+    fprintf (stderr, "%s is not a heatmap snapshot\n", path);
+    canvas.release ();
+    return false;
+  }
+  return true;
+}
+
+void
+heatmap_snapshot_list (const char *dir, unsigned int source_id,
+    vector<HeatmapSnapshotInfo> &snapshots)
+{
+  snapshots.clear ();
+  string source_dir = string (dir) + "/" + to_string (source_id);
+  DIR *d = opendir (source_dir.c_str ());
+  if (!d)
+    return;
+  struct dirent *entry;
+  while ((entry = readdir (d)) != NULL) {
+    long long time;
+    if (!parse_name (entry->d_name, ".png", &time) &&
+        !parse_name (entry->d_name, ".tiff", &time))
+      continue;
+    HeatmapSnapshotInfo info;
+    info.source_id = source_id;
+    info.time = time;
+    info.path = source_dir + "/" + entry->d_name;
+    snapshots.push_back (info);
+  }
+  closedir (d);
+  std::sort (snapshots.begin (), snapshots.end (),
+      [] (const HeatmapSnapshotInfo &a, const HeatmapSnapshotInfo &b) {
+        return a.time < b.time;
+      });
+}
+
+void
+heatmap_snapshot_sources (const char *dir, vector<unsigned int> &source_ids)
+{
+  source_ids.clear ();
+  DIR *d = opendir (dir);
+  if (!d)
+    return;
+  struct dirent *entry;
+  while ((entry = readdir (d)) != NULL) {
+    long long id;
+    if (parse_name (entry->d_name, "", &id) && id <= UINT32_MAX)
+      source_ids.push_back ((unsigned int) id);
+  }
+  closedir (d);
+  std::sort (source_ids.begin (), source_ids.end ());
+}
+
+/* Latest snapshot at or before time, or NULL. */
+static const HeatmapSnapshotInfo *
+latest_at (const vector<HeatmapSnapshotInfo> &snapshots, int64_t time)
+{
+  auto it = std::upper_bound (snapshots.begin (), snapshots.end (), time,
+      [] (int64_t t, const HeatmapSnapshotInfo &info) {
+        return t < info.time;
+      });
+  return it == snapshots.begin () ? NULL : &*(it - 1);
+}
+
+bool
+heatmap_snapshot_period (const char *dir, unsigned int source_id,
+    int64_t from, int64_t to, Mat &canvas)
+{
+  vector<HeatmapSnapshotInfo> snapshots;
+  heatmap_snapshot_list (dir, source_id, snapshots);
+  const HeatmapSnapshotInfo *end = latest_at (snapshots, to);
+  if (!end || !heatmap_snapshot_load (end->path.c_str (), canvas))
+    return false;
+
+  /* A saturated pixel stopped counting at some point before the snapshot,
+   * so its difference is too low. */
+  double hi = 0;
+  if (canvas.type () != CV_32FC1)
+    minMaxLoc (canvas, NULL, &hi);
+  if ((canvas.type () == CV_16UC1 && hi >= 0xffff) ||
+      (canvas.type () == CV_32SC1 && hi >= INT32_MAX))
+    fprintf (stderr, "%s has saturated pixels, their footfall is "
+        "undercounted\n", end->path.c_str ());
+
+  const HeatmapSnapshotInfo *start = latest_at (snapshots, from);
+  if (start && start != end) {
+    Mat before;
+    if (!heatmap_snapshot_load (start->path.c_str (), before) ||
+        before.size () != canvas.size ())
+      return false;
+    /* The accumulator type may have changed in between. */
+    if (before.type () != canvas.type ())
+      before.convertTo (before, canvas.type ());
+    /* Clamps at zero where the later canvas is lower, i.e. after a
+     * reset. */
+    subtract (canvas, before, canvas);
+    cv::max (canvas, 0.0, canvas);
+  } else if (start) {
+    canvas.setTo (0);
+  }
+  return true;
+}
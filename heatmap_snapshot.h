@@ -0,0 +1,56 @@
+/*
+ * Persisted accumulator snapshots.
+ *
+ * The app periodically writes each source's cumulative canvas to
+ * <dir>/<source_id>/<unix_seconds>.tiff, as int32 or float like the canvas
+ * (see HeatmapGeometry), which keeps the counts exact. Because snapshots are
+ * cumulative, the footfall of any period between two snapshots is the later
+ * one minus the earlier one, so periods of any length cost two reads.
+ *
+ * That only holds while no pixel saturates, which a busy pixel of a uint16
+ * canvas does within days; the app therefore only snapshots int32 and float
+ * canvases. 16-bit canvases are still written, as <unix_seconds>.png, and
+ * read.
+ */
+
+#ifndef __HEATMAP_SNAPSHOT_H__
+#define __HEATMAP_SNAPSHOT_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+struct HeatmapSnapshotInfo {
+  unsigned int source_id;
+  /* Unix seconds. */
+  int64_t time;
+  std::string path;
+};
+
+/* Writes canvas as the snapshot of source_id at time, creating directories
+ * as needed. The file appears atomically. */
+bool heatmap_snapshot_save (const char *dir, unsigned int source_id,
+    int64_t time, const cv::Mat &canvas);
+
+/* Reads a snapshot written by heatmap_snapshot_save, as CV_16UC1, CV_32SC1
+ * or CV_32FC1. */
+bool heatmap_snapshot_load (const char *path, cv::Mat &canvas);
+
+/* Snapshots of source_id in dir, oldest first. */
+void heatmap_snapshot_list (const char *dir, unsigned int source_id,
+    std::vector<HeatmapSnapshotInfo> &snapshots);
+
+/* Source ids that have a snapshot directory in dir, ascending. */
+void heatmap_snapshot_sources (const char *dir,
+    std::vector<unsigned int> &source_ids);
+
+/* Footfall of source_id accumulated in [from, to): the latest snapshot at
+ * or before to, minus the latest one at or before from (nothing if there is
+ * none). Warns on stderr if the later snapshot has saturated pixels.
+ * Returns false if there is no snapshot at or before to. */
+bool heatmap_snapshot_period (const char *dir, unsigned int source_id,
+    int64_t from, int64_t to, cv::Mat &canvas);
+
+#endif
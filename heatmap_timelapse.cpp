@@ -0,0 +1,266 @@
+/*
+ * Background time-lapse export. See heatmap_timelapse.h.
+ */
+
+#include "heatmap_timelapse.h"
+
+#include <stdio.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+using namespace cv;
+using namespace std;
+
+/* One queued video frame: a slot to encode, or slot == -1 for repeats of
+ * the last encoded image. */
+struct TimelapseEntry {
+  int slot;
+  uint64_t repeats;
+};
+
+struct HeatmapTimelapse {
+  HeatmapTimelapseParams params;
+  string output;
+  VideoWriter writer;
+
+  std::mutex lock;
+  /* Signals the thread that there is work or that it should stop. */
+  std::condition_variable work;
+  /* Signals blocking submitters that a slot came free. */
+  std::condition_variable space;
+
+  /* Frame images, all allocated at open. A slot is free, queued, being
+   * encoded, or pinned as the image that repeats refer to. */
+  vector<Mat> slots;
+  vector<int> free_slots;
+
+  /* Fixed ring of entries. Repeats never queue back to back, so twice the
+   * number of slots is enough. */
+  vector<TimelapseEntry> ring;
+  size_t head;
+  size_t count;
+
+  bool have_version;
+  uint64_t last_version;
+  bool stopping;
+  HeatmapTimelapseStats stats;
+  std::thread thread;
+};
+
+void
+heatmap_timelapse_default_params (HeatmapTimelapseParams *params,
+    const char *output, int width, int height)
+{
+  params->output = output;
+  params->gstreamer = false;
+  params->fourcc = VideoWriter::fourcc ('M', 'J', 'P', 'G');
+  params->fps = HEATMAP_TIMELAPSE_DEFAULT_FPS;
+  params->width = width;
+  params->height = height;
+  params->queue_frames = HEATMAP_TIMELAPSE_DEFAULT_QUEUE;
+  params->drop = HEATMAP_TIMELAPSE_DROP_OLDEST;
+}
+
+static void
+push_entry (HeatmapTimelapse *tl, int slot, uint64_t repeats)
+{
+  TimelapseEntry &entry = tl->ring[(tl->head + tl->count) % tl->ring.size ()];
+  entry.slot = slot;
+  entry.repeats = repeats;
+  tl->count++;
+}
+
+static TimelapseEntry
+pop_entry (HeatmapTimelapse *tl)
+{
+  TimelapseEntry entry = tl->ring[tl->head];
+  tl->head = (tl->head + 1) % tl->ring.size ();
+  tl->count--;
+  return entry;
+}
+
+static void
+encode_loop (HeatmapTimelapse *tl)
+{
+  int pinned = -1;
+  std::unique_lock<std::mutex> guard (tl->lock);
+  for (;;) {
+    tl->work.wait (guard, [tl] { return tl->count || tl->stopping; });
+    if (!tl->count)
+      break;
+    TimelapseEntry entry = pop_entry (tl);
+    guard.unlock ();
+
+    /* The slot being encoded is neither free nor queued, so producers
+     * leave it alone while the lock is released. */
+    int shown = entry.slot >= 0 ? entry.slot : pinned;
+    if (shown >= 0) {
+      uint64_t n = entry.slot >= 0 ? 1 : entry.repeats;
+      for (uint64_t i = 0; i < n; i++)
+        tl->writer.write (tl->slots[shown]);
+    }
+
+    guard.lock ();
+    if (entry.slot >= 0) {
+      if (pinned >= 0)
+        tl->free_slots.push_back (pinned);
+      pinned = entry.slot;
+      tl->stats.encoded++;
+      tl->space.notify_one ();
+    } else if (shown >= 0) {
+      tl->stats.repeated += entry.repeats;
+    } else {
+      tl->stats.dropped += entry.repeats;
+    }
+  }
+}
+
+HeatmapTimelapse *
+heatmap_timelapse_open (const HeatmapTimelapseParams *params)
+{
+  if (params->width <= 0 || params->height <= 0 || params->fps <= 0 ||
+      params->queue_frames <= 0)
+    return NULL;
+
+  HeatmapTimelapse *tl = new HeatmapTimelapse ();
+  tl->params = *params;
+  tl->output = params->output;
+  tl->params.output = tl->output.c_str ();
+  Size size (params->width, params->height);
+  if (params->gstreamer)
+    tl->writer.open (tl->output, CAP_GSTREAMER, 0, params->fps, size, true);
+  else
+    tl->writer.open (tl->output, params->fourcc, params->fps, size, true);
+  if (!tl->writer.isOpened ()) {
+    fprintf (stderr, "Failed to open time-lapse output %s\n",
+        tl->output.c_str ());
+    delete tl;
+    return NULL;
+  }
+
+  /* Queued frames, plus the one being encoded and the pinned one. */
+  int num_slots = params->queue_frames + 2;
+  tl->slots.resize (num_slots);
+  for (int i = 0; i < num_slots; i++) {
+    tl->slots[i].create (size, CV_8UC3);
+    tl->free_slots.push_back (i);
+  }
+  tl->ring.resize (2 * num_slots + 2);
+  tl->head = 0;
+  tl->count = 0;
+  tl->have_version = false;
+  tl->last_version = 0;
+  tl->stopping = false;
+  tl->stats = HeatmapTimelapseStats ();
+  tl->thread = std::thread (encode_loop, tl);
+  return tl;
+}
+
+/* Makes a slot free according to the drop policy. Called with the lock
+ * held; returns false if the new frame has to be dropped instead. */
+static bool
+make_room (HeatmapTimelapse *tl, std::unique_lock<std::mutex> &guard)
+{
+  switch (tl->params.drop) {
+    case HEATMAP_TIMELAPSE_BLOCK:
+      tl->space.wait (guard, [tl] { return !tl->free_slots.empty (); });
+      return true;
+    case HEATMAP_TIMELAPSE_DROP_OLDEST:
+      while (tl->free_slots.empty () && tl->count) {
+        TimelapseEntry entry = pop_entry (tl);
+        if (entry.slot >= 0) {
+          tl->free_slots.push_back (entry.slot);
+          tl->stats.dropped++;
+          /* Repeats of the dropped image would otherwise show the one
+           * encoded before it. */
+          while (tl->count && tl->ring[tl->head].slot < 0)
+            tl->stats.dropped += pop_entry (tl).repeats;
+        } else {
+          tl->stats.dropped += entry.repeats;
+        }
+      }
+      /* With nothing queued, the next frame cannot repeat a dropped one. */
+      if (!tl->count)
+        tl->have_version = false;
+      return !tl->free_slots.empty ();
+    default:
+      return false;
+  }
+}
+
+bool
+heatmap_timelapse_submit (HeatmapTimelapse *tl, const Mat &frame,
+    uint64_t version)
+{
+  std::unique_lock<std::mutex> guard (tl->lock);
+  tl->stats.submitted++;
+
+  if (tl->have_version && version == tl->last_version) {
+    /* Fold into a trailing repeat entry if there is one. */
+    if (tl->count) {
+      TimelapseEntry &tail =
+          tl->ring[(tl->head + tl->count - 1) % tl->ring.size ()];
+      if (tail.slot < 0) {
+        tail.repeats++;
+        return true;
+      }
+    }
+    push_entry (tl, -1, 1);
+    tl->work.notify_one ();
+    return true;
+  }
+
+  if (frame.empty () ||
+      (tl->free_slots.empty () && !make_room (tl, guard))) {
+    tl->stats.dropped++;
+    /* The next frame cannot repeat one that was never queued. */
+    tl->have_version = false;
+    return false;
+  }
+  int slot = tl->free_slots.back ();
+  tl->free_slots.pop_back ();
+  guard.unlock ();
+
+  /* The slot is owned by this call until it is queued. */
+  Mat &dst = tl->slots[slot];
+  if (frame.size () == dst.size ())
+    frame.copyTo (dst);
+  else
+    resize (frame, dst, dst.size (), 0, 0, INTER_AREA);
+
+  guard.lock ();
+  push_entry (tl, slot, 0);
+  tl->have_version = true;
+  tl->last_version = version;
+  tl->work.notify_one ();
+  return true;
+}
+
+void
+heatmap_timelapse_get_stats (HeatmapTimelapse *tl, HeatmapTimelapseStats *stats)
+{
+  std::lock_guard<std::mutex> guard (tl->lock);
+  *stats = tl->stats;
+}
+
+void
+heatmap_timelapse_close (HeatmapTimelapse *tl, HeatmapTimelapseStats *stats)
+{
+  {
+    std::lock_guard<std::mutex> guard (tl->lock);
+    tl->stopping = true;
+  }
+  tl->work.notify_one ();
+  tl->thread.join ();
+  tl->writer.release ();
+  if (stats)
+    *stats = tl->stats;
+  delete tl;
+}
@@ -0,0 +1,81 @@
+/*
+ * Background time-lapse export of heatmap renders.
+ *
+ * Frames are handed to heatmap_timelapse_submit, which copies them into a
+ * preallocated slot of a bounded queue and returns; a dedicated thread
+ * encodes them with cv::VideoWriter, either to a file or into a GStreamer
+ * pipeline starting with appsrc. When the queue is full the drop policy
+ * decides what gives, so a live producer never waits on the encoder.
+ * Frames whose version equals the previous frame's are queued as repeats
+ * of the last encoded image, without a copy.
+ */
+
+#ifndef __HEATMAP_TIMELAPSE_H__
+#define __HEATMAP_TIMELAPSE_H__
+
+#include <stdint.h>
+
+#include "opencv2/core/core.hpp"
+
+#define HEATMAP_TIMELAPSE_DEFAULT_FPS 30
+#define HEATMAP_TIMELAPSE_DEFAULT_QUEUE 8
+
+enum HeatmapTimelapseDrop {
+  /* Discard the frame being submitted. */
+  HEATMAP_TIMELAPSE_DROP_NEWEST,
+  /* Discard the oldest queued frame, and its repeats, to make room. */
+  HEATMAP_TIMELAPSE_DROP_OLDEST,
+  /* Wait for room. Only for offline export, never in the pipeline. */
+  HEATMAP_TIMELAPSE_BLOCK,
+};
+
+struct HeatmapTimelapseParams {
+  /* Output file, or a GStreamer pipeline if gstreamer is set, e.g.
+   * "appsrc ! videoconvert ! x264enc ! mp4mux ! filesink location=a.mp4". */
+  const char *output;
+  bool gstreamer;
+  /* cv::VideoWriter::fourcc code for file output, e.g. MJPG for .avi. */
+  int fourcc;
+  double fps;
+  /* Frame size of the video; submitted frames of another size are
+   * resized. */
+  int width;
+  int height;
+  /* Frames that can wait for the encoder. */
+  int queue_frames;
+  HeatmapTimelapseDrop drop;
+};
+
+struct HeatmapTimelapseStats {
+  uint64_t submitted;
+  /* Distinct images encoded, and frames written as repeats of the last. */
+  uint64_t encoded;
+  uint64_t repeated;
+  uint64_t dropped;
+};
+
+struct HeatmapTimelapse;
+
+/* MJPG at HEATMAP_TIMELAPSE_DEFAULT_FPS, default queue, drop oldest. */
+void heatmap_timelapse_default_params (HeatmapTimelapseParams *params,
+    const char *output, int width, int height);
+
+/* Opens the writer and starts the encoding thread, NULL on failure. */
+HeatmapTimelapse *heatmap_timelapse_open (const HeatmapTimelapseParams *params);
+
+/* Queues a CV_8UC3 frame. version identifies its content: a frame with the
+ * same version as the previous one is written as a repeat and may be left
+ * empty, so an unchanged heatmap need not be rendered again. Returns false
+ * if the frame was dropped. Submit from one thread at a time. */
+bool heatmap_timelapse_submit (HeatmapTimelapse *timelapse,
+    const cv::Mat &frame, uint64_t version);
+
+void heatmap_timelapse_get_stats (HeatmapTimelapse *timelapse,
+    HeatmapTimelapseStats *stats);
+
+/* Encodes whatever is still queued, stops the thread and closes the
+ * video. Stores the final counts in stats unless it is NULL. */
+void heatmap_timelapse_close (HeatmapTimelapse *timelapse,
+    HeatmapTimelapseStats *stats);
+
+#endif
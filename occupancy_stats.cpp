@@ -0,0 +1,295 @@
+/*
+ * Streaming occupancy analytics. See occupancy_stats.h.
+ */
+
+#include "occupancy_stats.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#include "heatmap_engine.h"
+
+using namespace std;
+
+struct OccupancyTracker {
+  std::mutex lock;
+  int64_t interval_us;
+  int num_intervals;
+  /* Fixed ring of num_intervals slots, indexed by interval number. */
+  OccupancyInterval *ring;
+  OccupancySketch total;
+  double ewma_short;
+  double ewma_long;
+  int64_t last_us;
+};
+
+static int64_t default_interval_us =
+    (int64_t) OCCUPANCY_DEFAULT_INTERVAL_SEC * 1000000;
+static int default_num_intervals = OCCUPANCY_DEFAULT_INTERVALS;
+
+static std::atomic<OccupancyTracker *> trackers[HEATMAP_MAX_SOURCES];
+static std::mutex trackers_lock;
+
+static inline int
+bin_index (uint32_t value)
+{
+  if (value < OCCUPANCY_EXACT_BINS)
+    return (int) value;
+  if (value > 0xffff)
+    value = 0xffff;
+  /* value is in [2^(octave+5), 2^(octave+6)). */
+  int octave = 31 - __builtin_clz (value) - 5;
+  int sub = (value >> (octave + 2)) & (OCCUPANCY_SUB_BINS - 1);
+  return OCCUPANCY_EXACT_BINS + octave * OCCUPANCY_SUB_BINS + sub;
+}
+
+/* [lower, lower + width) is the range of values that land in bin. */
+static inline void
+bin_range (int bin, double *lower, double *width)
+{
+  if (bin < OCCUPANCY_EXACT_BINS) {
+    *lower = bin;
+    *width = 1;
+    return;
+  }
+  int octave = (bin - OCCUPANCY_EXACT_BINS) / OCCUPANCY_SUB_BINS;
+  int sub = (bin - OCCUPANCY_EXACT_BINS) % OCCUPANCY_SUB_BINS;
+  *lower = (double) ((OCCUPANCY_SUB_BINS + sub) << (octave + 2));
+  *width = (double) (1 << (octave + 2));
+}
+
+void
+occupancy_sketch_reset (OccupancySketch *sketch)
+{
+  memset (sketch, 0, sizeof (*sketch));
+  sketch->min = UINT32_MAX;
+}
+
+void
+occupancy_sketch_add (OccupancySketch *sketch, uint32_t value,
+    int64_t timestamp_us)
+{
+  if (!sketch->frames || value > sketch->max) {
+    sketch->max = value;
+    sketch->peak_time_us = timestamp_us;
+  }
+  sketch->min = std::min (sketch->min, value);
+  sketch->frames++;
+  sketch->sum += value;
+  sketch->bins[bin_index (value)]++;
+}
+
+void
+occupancy_sketch_merge (OccupancySketch *dst, const OccupancySketch *src)
+{
+  if (!src->frames)
+    return;
+  if (!dst->frames || src->max > dst->max ||
+      (src->max == dst->max && src->peak_time_us < dst->peak_time_us)) {
+    dst->max = src->max;
+    dst->peak_time_us = src->peak_time_us;
+  }
+  dst->min = std::min (dst->min, src->min);
+  dst->frames += src->frames;
+  dst->sum += src->sum;
+  for (int i = 0; i < OCCUPANCY_NUM_BINS; i++)
+    dst->bins[i] += src->bins[i];
+}
+
+double
+occupancy_sketch_quantile (const OccupancySketch *sketch, double q)
+{
+  if (!sketch->frames)
+    return 0;
+  double rank = std::min (std::max (q, 0.0), 1.0) * sketch->frames;
+  uint64_t seen = 0;
+  for (int i = 0; i < OCCUPANCY_NUM_BINS; i++) {
+    if (!sketch->bins[i])
+      continue;
+    if (seen + sketch->bins[i] >= rank) {
+      double lower, width;
+      bin_range (i, &lower, &width);
+      if (width == 1)
+        return lower;
+      /* Interpolate within the bin, clamped to the observed extremes. */
+      double value = lower + width * (rank - seen) / sketch->bins[i];
+      return std::min (std::max (value, (double) sketch->min),
+          (double) sketch->max);
+    }
+    seen += sketch->bins[i];
+  }
+  return sketch->max;
+}
+
+void
+occupancy_summarize (const OccupancySketch *sketch, OccupancySummary *summary)
+{
+  memset (summary, 0, sizeof (*summary));
+  summary->frames = sketch->frames;
+  if (!sketch->frames)
+    return;
+  summary->mean = (double) sketch->sum / sketch->frames;
+  summary->min = sketch->min;
+  summary->max = sketch->max;
+  summary->p50 = occupancy_sketch_quantile (sketch, 0.50);
+  summary->p90 = occupancy_sketch_quantile (sketch, 0.90);
+  summary->p99 = occupancy_sketch_quantile (sketch, 0.99);
+  summary->peak_time_us = sketch->peak_time_us;
+}
+
+void
+occupancy_init (int interval_sec, int num_intervals)
+{
+  default_interval_us = (int64_t) interval_sec * 1000000;
+  default_num_intervals = num_intervals;
+}
+
+static OccupancyTracker *
+get_tracker (unsigned int source_id)
+{
+  if (source_id >= HEATMAP_MAX_SOURCES)
+    return NULL;
+  return trackers[source_id].load (std::memory_order_acquire);
+}
+
+bool
+occupancy_add_source (unsigned int source_id)
+{
+  if (source_id >= HEATMAP_MAX_SOURCES)
+    return false;
+
+  std::lock_guard<std::mutex> guard (trackers_lock);
+  if (trackers[source_id].load (std::memory_order_relaxed))
+    return true;
+  OccupancyTracker *tracker = new OccupancyTracker ();
+  tracker->interval_us = default_interval_us;
+  tracker->num_intervals = default_num_intervals;
+  tracker->ring = new OccupancyInterval[default_num_intervals];
+  for (int i = 0; i < default_num_intervals; i++) {
+    tracker->ring[i].start_us = OCCUPANCY_UNUSED;
+    occupancy_sketch_reset (&tracker->ring[i].sketch);
+  }
+  occupancy_sketch_reset (&tracker->total);
+  tracker->ewma_short = 0;
+  tracker->ewma_long = 0;
+  tracker->last_us = OCCUPANCY_UNUSED;
+  trackers[source_id].store (tracker, std::memory_order_release);
+  return true;
+}
+
+void
+occupancy_update (unsigned int source_id, uint32_t count, int64_t timestamp_us)
+{
+  /* Sources that were never added are not tracked. */
+  OccupancyTracker *tracker = get_tracker (source_id);
+  if (!tracker)
+    return;
+
+  std::lock_guard<std::mutex> guard (tracker->lock);
+  int64_t number = timestamp_us / tracker->interval_us;
+  OccupancyInterval *slot = &tracker->ring[number % tracker->num_intervals];
+  int64_t start = number * tracker->interval_us;
+  if (slot->start_us != start) {
+    /* Older data in the slot is a full ring behind; recycle it. */
+    if (slot->start_us > start)
+      return;
+    slot->start_us = start;
+    occupancy_sketch_reset (&slot->sketch);
+  }
+  occupancy_sketch_add (&slot->sketch, count, timestamp_us);
+  occupancy_sketch_add (&tracker->total, count, timestamp_us);
+
+  /* Time-based smoothing so the averages do not depend on the frame rate. */
+  if (tracker->last_us == OCCUPANCY_UNUSED) {
+    tracker->ewma_short = count;
+    tracker->ewma_long = count;
+  } else if (timestamp_us > tracker->last_us) {
+    double dt = (timestamp_us - tracker->last_us) / 1e6;
+    double a_short = 1.0 - exp (-dt / OCCUPANCY_EWMA_SHORT_SEC);
+    double a_long = 1.0 - exp (-dt / OCCUPANCY_EWMA_LONG_SEC);
+    tracker->ewma_short += a_short * (count - tracker->ewma_short);
+    tracker->ewma_long += a_long * (count - tracker->ewma_long);
+  }
+  tracker->last_us = std::max (tracker->last_us, timestamp_us);
+}
+
+bool
+occupancy_query (const unsigned int *source_ids, unsigned int num_sources,
+    int64_t from_us, int64_t to_us, OccupancySummary *summary)
+{
+  OccupancySketch merged;
+  occupancy_sketch_reset (&merged);
+  unsigned int peak_source = 0;
+  double ewma_short = 0, ewma_long = 0;
+  bool lifetime = from_us == 0 && to_us == 0;
+
+  unsigned int n = num_sources ? num_sources : HEATMAP_MAX_SOURCES;
+  for (unsigned int i = 0; i < n; i++) {
+    unsigned int id = num_sources ? source_ids[i] : i;
+    OccupancyTracker *tracker = get_tracker (id);
+    if (!tracker)
+      continue;
+
+    std::lock_guard<std::mutex> guard (tracker->lock);
+    uint32_t old_max = merged.max;
+    uint64_t old_frames = merged.frames;
+    if (lifetime) {
+      occupancy_sketch_merge (&merged, &tracker->total);
+    } else {
+      for (int s = 0; s < tracker->num_intervals; s++) {
+        const OccupancyInterval *interval = &tracker->ring[s];
+        if (interval->start_us != OCCUPANCY_UNUSED &&
+            interval->start_us >= from_us &&
+            interval->start_us < to_us)
+          occupancy_sketch_merge (&merged, &interval->sketch);
+      }
+    }
+    if (merged.frames != old_frames && (!old_frames || merged.max > old_max))
+      peak_source = id;
+    ewma_short += tracker->ewma_short;
+    ewma_long += tracker->ewma_long;
+  }
+
+  occupancy_summarize (&merged, summary);
+  summary->peak_source = peak_source;
+  summary->ewma_short = ewma_short;
+  summary->ewma_long = ewma_long;
+  return merged.frames > 0;
+}
+
+void
+occupancy_list_intervals (unsigned int source_id,
+    vector<OccupancyInterval> &intervals)
+{
+  intervals.clear ();
+  OccupancyTracker *tracker = get_tracker (source_id);
+  if (!tracker)
+    return;
+
+  std::lock_guard<std::mutex> guard (tracker->lock);
+  for (int s = 0; s < tracker->num_intervals; s++) {
+    if (tracker->ring[s].start_us != OCCUPANCY_UNUSED)
+      intervals.push_back (tracker->ring[s]);
+  }
+  std::sort (intervals.begin (), intervals.end (),
+      [] (const OccupancyInterval &a, const OccupancyInterval &b) {
+        return a.start_us < b.start_us;
+      });
+}
+
+size_t
+occupancy_memory_bytes (void)
+{
+  size_t bytes = 0;
+  for (unsigned int i = 0; i < HEATMAP_MAX_SOURCES; i++) {
+    OccupancyTracker *tracker = get_tracker (i);
+    if (tracker)
+      bytes += sizeof (*tracker) +
+          tracker->num_intervals * sizeof (OccupancyInterval);
+  }
+  return bytes;
+}
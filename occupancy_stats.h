@@ -0,0 +1,109 @@
+/*
+ * Streaming occupancy analytics.
+ *
+ * Keeps, per source, the distribution of people-per-frame over fixed time
+ * intervals (15 minutes by default) in a ring of the last N intervals, plus
+ * a lifetime total and short/long moving averages. Memory is fixed when a
+ * source is added and every frame is an O(1) update that never allocates.
+ *
+ * Distributions are log-linear histograms: exact below 32 people, then 8
+ * sub-buckets per power of two (at most 12.5% relative error on quantiles)
+ * up to 65535. Unlike t-digest they merge exactly, so any set of intervals
+ * and sources can be combined for a query. One interval is about 0.5 KiB, so
+ * a day at the default interval is ~50 KiB per camera and 50 cameras fit in
+ * 2.5 MiB.
+ */
+
+#ifndef __OCCUPANCY_STATS_H__
+#define __OCCUPANCY_STATS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define OCCUPANCY_DEFAULT_INTERVAL_SEC 900
+#define OCCUPANCY_DEFAULT_INTERVALS 96
+
+/* Time constants of the moving averages. */
+#define OCCUPANCY_EWMA_SHORT_SEC 60
+#define OCCUPANCY_EWMA_LONG_SEC 900
+
+#define OCCUPANCY_UNUSED INT64_MIN
+
+#define OCCUPANCY_EXACT_BINS 32
+#define OCCUPANCY_SUB_BINS 8
+#define OCCUPANCY_OCTAVES 11
+#define OCCUPANCY_NUM_BINS \
+  (OCCUPANCY_EXACT_BINS + OCCUPANCY_SUB_BINS * OCCUPANCY_OCTAVES)
+
+struct OccupancySketch {
+  uint64_t frames;
+  uint64_t sum;
+  uint32_t min;
+  uint32_t max;
+  /* When max was first reached. */
+  int64_t peak_time_us;
+  uint32_t bins[OCCUPANCY_NUM_BINS];
+};
+
+struct OccupancyInterval {
+  /* Start of the interval; OCCUPANCY_UNUSED marks an unused slot. */
+  int64_t start_us;
+  OccupancySketch sketch;
+};
+
+struct OccupancySummary {
+  uint64_t frames;
+  double mean;
+  uint32_t min;
+  uint32_t max;
+  double p50;
+  double p90;
+  double p99;
+  int64_t peak_time_us;
+  unsigned int peak_source;
+  /* Sum of the per-source moving averages at query time. */
+  double ewma_short;
+  double ewma_long;
+};
+
+void occupancy_sketch_reset (OccupancySketch *sketch);
+void occupancy_sketch_add (OccupancySketch *sketch, uint32_t value,
+    int64_t timestamp_us);
+void occupancy_sketch_merge (OccupancySketch *dst, const OccupancySketch *src);
+
+/* q in [0, 1]. Returns 0 for an empty sketch. */
+double occupancy_sketch_quantile (const OccupancySketch *sketch, double q);
+
+/* Sets interval length and ring size for sources added from now on. */
+void occupancy_init (int interval_sec, int num_intervals);
+
+/* Allocates the tracker of source_id; call it when the source is set up,
+ * before its first frame. Does nothing if the source is already tracked.
+ * Returns false if source_id is out of range. */
+bool occupancy_add_source (unsigned int source_id);
+
+/* Records the person count of one frame of source_id, taken at timestamp_us
+ * (wall clock). Timestamps must not go backwards by more than an interval.
+ * Counts of sources that were not added are dropped. */
+void occupancy_update (unsigned int source_id, uint32_t count,
+    int64_t timestamp_us);
+
+/* Merges every interval starting in [from_us, to_us) of the given sources.
+ * Pass num_sources == 0 for all sources, and from_us == to_us == 0 for each
+ * source's lifetime totals. Returns false if nothing matched. */
+bool occupancy_query (const unsigned int *source_ids, unsigned int num_sources,
+    int64_t from_us, int64_t to_us, OccupancySummary *summary);
+
+/* Copies the used intervals of source_id, oldest first. */
+void occupancy_list_intervals (unsigned int source_id,
+    std::vector<OccupancyInterval> &intervals);
+
+/* Summarises a single sketch, without the moving averages. */
+void occupancy_summarize (const OccupancySketch *sketch,
+    OccupancySummary *summary);
+
+/* Bytes held by all tracked sources. */
+size_t occupancy_memory_bytes (void);
+
+#endif
@@ -37,7 +37,15 @@
 /* Open CV headers */
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
+#include <vector>
 
+#include "heatmap_config.h"
+#include "heatmap_engine.h"
+#include "heatmap_replay.h"
+#include "heatmap_server.h"
+#include "heatmap_snapshot.h"
+#include "heatmap_timelapse.h"
+#include "occupancy_stats.h"
 
 
  
@@ -50,6 +58,9 @@
 using namespace cv;
 using namespace std;
 #define MAX_DISPLAY_LEN 64
+/* Detections per frame fed to the heatmap; the rest are dropped and
+ * counted. */
+#define MAX_DETECTIONS_PER_FRAME 512
 
 #define PGIE_CLASS_ID_VEHICLE 1
 #define PGIE_CLASS_ID_PERSON 0
@@ -60,18 +71,37 @@ static gboolean PERF_MODE = FALSE;
 static long long counter =0;
 
 
-/* The muxer output resolution must be set if the input streams will be of
- * different resolution. The muxer will scale all the input frames to this
- * resolution. */
-#define MUXER_OUTPUT_WIDTH 1280
-#define MUXER_OUTPUT_HEIGHT 780
-
 /* Muxer batch formation timeout, for e.g. 40 millisec. Should ideally be set
  * based on the fastest source's framerate. */
 #define MUXER_BATCH_TIMEOUT_USEC 40000
-Mat canvas = Mat::zeros(MUXER_OUTPUT_HEIGHT,MUXER_OUTPUT_WIDTH,CV_16UC1);
-// Mat ones = Mat::ones(MUXER_OUTPUT_HEIGHT,MUXER_OUTPUT_WIDTH,CV_16UC1);
-Mat ones(MUXER_OUTPUT_HEIGHT,MUXER_OUTPUT_WIDTH,CV_16UC1,Scalar(5));
+
+/* Optional heatmap settings, see heatmap_config.h. */
+#define HEATMAP_CONFIG_FILE "heatmap_config.txt"
+
+/* Cumulative canvases are persisted here at this interval and on exit, see
+ * heatmap_snapshot.h. Only with an int32 or float accumulator: busy pixels
+ * of a uint16 canvas saturate, after which periods show no footfall
+ * there. */
+#define HEATMAP_SNAPSHOT_DIR "snapshots"
+#define HEATMAP_SNAPSHOT_INTERVAL_SEC 3600
+
+/* With FOOTFALL_TIMELAPSE_DIR set, an overlay of every source is added to
+ * <dir>/<source>.avi at this interval, see heatmap_timelapse.h. */
+#define HEATMAP_TIMELAPSE_INTERVAL_SEC 60
+
+/* The input is linked to streammux pad sink_1, so its frames carry this
+ * source_id. */
+#define INPUT_SOURCE_ID 1
+
+/* With FOOTFALL_RECORD_DETECTIONS set, the streaming thread queues up to
+ * this many frames and detections, written out by the main loop at this
+ * interval, see heatmap_replay.h. */
+#define DETECTIONS_LOG_FRAMES 1024
+#define DETECTIONS_LOG_DETECTIONS (DETECTIONS_LOG_FRAMES * 64)
+#define DETECTIONS_LOG_FLUSH_SEC 1
+
+/* Heatmaps are served on demand from this address, see heatmap_server.h. */
+#define HEATMAP_SERVER_ADDR "127.0.0.1"
 /* Check for parsing error. */
 #define RETURN_ON_PARSER_ERROR(parse_expr) \
   if (NVDS_YAML_PARSER_SUCCESS != parse_expr) { \
@@ -342,6 +372,96 @@ create_source_bin (guint index, gchar * uri)
 // }
 
 
+/* Per-source scratch for infer_sink_pad_buffer_probe: the BGRA surface each
+ * frame is converted into and the CUDA stream the conversion runs on. Both
+ * are created by add_source, at startup for the muxer resolution, and reused
+ * for every frame; the probe never creates them. */
+typedef struct {
+  NvBufSurface *inter_buf;
+  cudaStream_t cuda_stream;
+  guint width;
+  guint height;
+} SourceWorkspace;
+
+static SourceWorkspace source_workspaces[HEATMAP_MAX_SOURCES];
+
+/* Detections of the frame being processed. Reserved in main and filled up
+ * to MAX_DETECTIONS_PER_FRAME, so it never reallocates. */
+static std::vector<HeatmapDetection> frame_dets;
+static guint64 capped_detections = 0;
+
+/* Optional detection log, see heatmap_replay.h. */
+static HeatmapRecorder *detections_log = NULL;
+
+/* Whether the accumulator is wide enough for snapshots. */
+static gboolean snapshots_enabled = FALSE;
+
+/* Optional time-lapse output, one video per source, opened on first use. */
+static const gchar *timelapse_dir = NULL;
+static HeatmapTimelapse *timelapses[HEATMAP_MAX_SOURCES];
+static gboolean timelapse_failed[HEATMAP_MAX_SOURCES];
+static guint64 timelapse_versions[HEATMAP_MAX_SOURCES];
+
+static gboolean
+source_workspace_init (guint source_id, guint gpu_id, guint width,
+    guint height)
+{
+  SourceWorkspace *ws = &source_workspaces[source_id];
+  if (ws->inter_buf && ws->width == width && ws->height == height)
+    return TRUE;
+
+  if (ws->inter_buf) {
+    NvBufSurfaceDestroy (ws->inter_buf);
+    ws->inter_buf = NULL;
+  }
+
+  NvBufSurfaceCreateParams create_params;
+  create_params.gpuId = gpu_id;
+  create_params.width = width;
+  create_params.height = height;
+  create_params.size = 0;
+  create_params.colorFormat = NVBUF_COLOR_FORMAT_BGRA;
+  create_params.layout = NVBUF_LAYOUT_PITCH;
+#ifdef __aarch64__
+  create_params.memType = NVBUF_MEM_DEFAULT;
+#else
+  create_params.memType = NVBUF_MEM_CUDA_UNIFIED;
+#endif
+  if (NvBufSurfaceCreate (&ws->inter_buf, 1, &create_params) != 0) {
+    ws->inter_buf = NULL;
+    return FALSE;
+  }
+  if (!ws->cuda_stream)
+    CHECK_CUDA_STATUS (cudaStreamCreate (&ws->cuda_stream),
+        "Could not create cuda stream");
+  ws->width = width;
+  ws->height = height;
+  return TRUE;
+}
+
+/* Creates everything infer_sink_pad_buffer_probe needs for source_id. Must
+ * run before the source's first frame. */
+static gboolean
+add_source (guint source_id, guint gpu_id)
+{
+  if (!heatmap_engine_get_source (source_id) ||
+      !occupancy_add_source (source_id))
+    return FALSE;
+  return source_workspace_init (source_id, gpu_id, heatmap_engine_width (),
+      heatmap_engine_height ());
+}
+
+static void
+source_workspace_destroy (guint source_id)
+{
+  SourceWorkspace *ws = &source_workspaces[source_id];
+  if (ws->inter_buf)
+    NvBufSurfaceDestroy (ws->inter_buf);
+  if (ws->cuda_stream)
+    cudaStreamDestroy (ws->cuda_stream);
+  memset (ws, 0, sizeof (*ws));
+}
+
 static GstPadProbeReturn infer_sink_pad_buffer_probe(GstPad *pad,
                                                      GstPadProbeInfo *info,
                                                      gpointer u_data)
@@ -349,18 +469,14 @@ static GstPadProbeReturn infer_sink_pad_buffer_probe(GstPad *pad,
   GstBuffer *buf = (GstBuffer *)info->data;
   NvDsBatchMeta *batch_meta = gst_buffer_get_nvds_batch_meta(buf);
   NvDsMetaList *l_frame = NULL;
-  char file_name[128];
   NvDsObjectMeta *obj_meta = NULL;
+  std::vector<HeatmapDetection> &dets = frame_dets;
 
   NvDsMetaList * l_obj = NULL;  
 
 
-  // canvas = canvas - ones ; // this Mat will have some negative values.
-  
   counter++;
 
-  canvas.setTo(0, canvas < 0);
-
   // Get original raw data
   GstMapInfo in_map_info;
   if (!gst_buffer_map(buf, &in_map_info, GST_MAP_READ)) 
@@ -382,58 +498,54 @@ static GstPadProbeReturn infer_sink_pad_buffer_probe(GstPad *pad,
         l_frame = l_frame->next) {
       NvDsFrameMeta *frame_meta = (NvDsFrameMeta *)(l_frame->data);
 
-    int offset = 0;
+    HeatmapSource *heatmap = heatmap_engine_find_source(frame_meta->source_id);
+    dets.clear();
     for (l_obj = frame_meta->obj_meta_list; l_obj != NULL;l_obj = l_obj->next) 
     {   
-      obj_meta = (NvDsObjectMeta *) (l_obj->data);
-      int lower_mid_x = (int)(obj_meta->rect_params.left + obj_meta->rect_params.width/2);
-      int lower_mid_y = (int)(obj_meta->rect_params.top + obj_meta->rect_params.height);
-      if (obj_meta->class_id == PGIE_CLASS_ID_PERSON) {
-        Mat temp_heatmap =Mat::zeros(MUXER_OUTPUT_HEIGHT,MUXER_OUTPUT_WIDTH,CV_16UC1);
-        circle(temp_heatmap, Point((int)lower_mid_x,lower_mid_y),10, 5, -1);
-        canvas = canvas+temp_heatmap;
+      if (dets.size() == MAX_DETECTIONS_PER_FRAME) {
+        capped_detections++;
+        continue;
       }
+      obj_meta = (NvDsObjectMeta *) (l_obj->data);
+      HeatmapDetection det;
+      det.left = obj_meta->rect_params.left;
+      det.top = obj_meta->rect_params.top;
+      det.width = obj_meta->rect_params.width;
+      det.height = obj_meta->rect_params.height;
+      det.class_id = obj_meta->class_id;
+      det.confidence = obj_meta->confidence;
+      dets.push_back(det);
     }
+    if (heatmap)
+      heatmap_source_accumulate(heatmap, dets.data(), dets.size());
+    if (detections_log)
+      heatmap_recorder_add(detections_log, frame_number,
+          frame_meta->source_id, dets.data(), dets.size());
 
       guint height = surface->surfaceList[frame_meta->batch_id].height;
       guint width = surface->surfaceList[frame_meta->batch_id].width;
-      // Create Mat from NvMM memory, refer opencv API for how to create a Mat
-
-      // only rotate the first 10 frames
-      NvBufSurface *inter_buf = nullptr;
-      NvBufSurfaceCreateParams create_params;
-      create_params.gpuId = surface->gpuId;
-      create_params.width = width;
-      create_params.height = height;
-      create_params.size = 0;
-      create_params.colorFormat = NVBUF_COLOR_FORMAT_BGRA;
-      create_params.layout = NVBUF_LAYOUT_PITCH;
-  #ifdef __aarch64__
-      create_params.memType = NVBUF_MEM_DEFAULT;
-  #else
-      create_params.memType = NVBUF_MEM_CUDA_UNIFIED;
-  #endif
-  // Create another scratch RGBA NvBufSurface
-  if (NvBufSurfaceCreate(&inter_buf, 1, &create_params) != 0) 
-  {
-    GST_ERROR("Error: Could not allocate internal buffer ");
-    return GST_PAD_PROBE_OK;
-  }
+
+    SourceWorkspace *ws = frame_meta->source_id < HEATMAP_MAX_SOURCES ?
+        &source_workspaces[frame_meta->source_id] : NULL;
+    if (!ws || !ws->inter_buf || ws->width != width || ws->height != height) {
+      GST_ERROR("Error: No %ux%u workspace for source %u", width, height,
+          frame_meta->source_id);
+      continue;
+    }
+    NvBufSurface *inter_buf = ws->inter_buf;
 
     NvBufSurfTransformConfigParams transform_config_params;
     NvBufSurfTransformParams transform_params;
     NvBufSurfTransformRect src_rect;
     NvBufSurfTransformRect dst_rect;
-    cudaStream_t cuda_stream;
-    CHECK_CUDA_STATUS(cudaStreamCreate(&cuda_stream),"Could not create cuda stream");
     transform_config_params.compute_mode = NvBufSurfTransformCompute_Default;
     transform_config_params.gpu_id = surface->gpuId;
-    transform_config_params.cuda_stream = cuda_stream;
+    transform_config_params.cuda_stream = ws->cuda_stream;
     NvBufSurfTransform_Error err = NvBufSurfTransformSetSessionParams(&transform_config_params);
     if (err != NvBufSurfTransformError_Success) {
       cout << "NvBufSurfTransformSetSessionParams failed with error " << err
            << endl;
-      return GST_PAD_PROBE_OK;
+      continue;
     }
     /* Set the transform ROIs for source and destination, only do the color
      * format conversion*/
@@ -452,7 +564,7 @@ static GstPadProbeReturn infer_sink_pad_buffer_probe(GstPad *pad,
     if (err != NvBufSurfTransformError_Success) {
       cout << "NvBufSurfTransform failed with error %d while converting buffer"
            << err << endl;
-      return GST_PAD_PROBE_OK;
+      continue;
     }
 
     // map for cpu
@@ -470,35 +582,12 @@ static GstPadProbeReturn infer_sink_pad_buffer_probe(GstPad *pad,
     Mat rawmat(height, width, CV_8UC4,
                inter_buf->surfaceList[0].mappedAddr.addr[0],
                inter_buf->surfaceList[0].planeParams.pitch[0]);
-    char *data = (char *)malloc(width * height * 4);
-    // make temp rotate mat from malloc buffer
-    Mat rotate_mat(width, height, CV_8UC4, data, height);
-    // Aplly your algo which works with opencv Mat, here we only rotate the Mat
-    // for demo
-    // cout<<"ROTATING.........."<<endl;
-    rotate(rawmat, rotate_mat, ROTATE_180);
-    rotate(rotate_mat, rotate_mat, ROTATE_180);
-    free(data);
-    if (frame_number % 30 == 0) {
-      Mat im_color;
-      Mat res;
-      Mat temp;
-      double alpha = 0.75; double beta;
-    beta = ( 1.0 - alpha );
-    Mat bgr;
-    cv::cvtColor(rotate_mat, bgr, cv::COLOR_RGBA2RGB);
-    canvas.convertTo(temp,CV_8UC1);
-    applyColorMap(temp, im_color, COLORMAP_JET);
-    snprintf(file_name, sizeof(file_name), "heatmap.png", 0);
-    addWeighted( bgr, alpha, im_color, beta, 0.0, res);
-      cv::imwrite(file_name, res);
-
-
-
-    snprintf(file_name, sizeof(file_name), "map.png", 0);
-      cv::imwrite(file_name, im_color);
-
-
+    /* Refresh the overlay background; rendering and encoding happen in the
+     * query server, only when a client asks for an image. The background
+     * is preallocated, so this converts in place. */
+    if (frame_number % 30 == 0 && heatmap) {
+      heatmap_source_update_background(heatmap, rawmat,
+          cv::COLOR_RGBA2RGB);
     }
 #ifdef PLATFORM_TEGRA
     if (inter_buf->memType == NVBUF_MEM_SURFACE_ARRAY) {
@@ -507,7 +596,6 @@ static GstPadProbeReturn infer_sink_pad_buffer_probe(GstPad *pad,
 #endif
     // unmap
     NvBufSurfaceUnMap(inter_buf, 0, -1);
-    NvBufSurfaceDestroy(inter_buf);
   }
 
 #ifdef PLATFORM_TEGRA
@@ -543,6 +631,9 @@ osd_sink_pad_buffer_probe (GstPad * pad, GstPadProbeInfo * info,
       l_frame = l_frame->next) {
         NvDsFrameMeta *frame_meta = (NvDsFrameMeta *) (l_frame->data);
         int offset = 0;
+        /* Counts are per frame, also when a batch holds several sources. */
+        vehicle_count = 0;
+        person_count = 0;
         for (l_obj = frame_meta->obj_meta_list; l_obj != NULL;
                 l_obj = l_obj->next) {
             obj_meta = (NvDsObjectMeta *) (l_obj->data);
@@ -555,12 +646,17 @@ osd_sink_pad_buffer_probe (GstPad * pad, GstPadProbeInfo * info,
                 num_rects++;
             }
         }
+        occupancy_update(frame_meta->source_id, person_count,
+            g_get_real_time());
+
         display_meta = nvds_acquire_display_meta_from_pool(batch_meta);
         NvOSD_TextParams *txt_params  = &display_meta->text_params[0];
         display_meta->num_labels = 1;
+        /* The display meta pool g_free()s display_text when the meta is
+         * released, so this buffer cannot come from a workspace. */
         txt_params->display_text = (char*)g_malloc0 (MAX_DISPLAY_LEN);
         offset = snprintf(txt_params->display_text, MAX_DISPLAY_LEN, "Person = %d ", person_count);
-        offset = snprintf(txt_params->display_text + offset , MAX_DISPLAY_LEN, "Vehicle = %d ", vehicle_count);
+        snprintf(txt_params->display_text + offset, MAX_DISPLAY_LEN - offset, "Vehicle = %d ", vehicle_count);
 
         /* Now set the offsets where the string should appear */
         txt_params->x_offset = 10;
@@ -619,6 +715,120 @@ bus_call (GstBus * bus, GstMessage * msg, gpointer data)
   return TRUE;
 }
 
+/* Writes every source's canvas to HEATMAP_SNAPSHOT_DIR. Runs on the main
+ * loop, so the TIFF encode never holds up the streaming thread for longer
+ * than the canvas copy. */
+static gboolean
+save_snapshots (gpointer data)
+{
+  unsigned int ids[HEATMAP_MAX_SOURCES];
+  unsigned int n = heatmap_engine_list_sources (ids, HEATMAP_MAX_SOURCES);
+  gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+  cv::Mat canvas;
+  for (unsigned int i = 0; i < n; i++) {
+    heatmap_source_snapshot (heatmap_engine_find_source (ids[i]),
+        HEATMAP_RENDER_MAP, canvas, NULL);
+    if (!heatmap_snapshot_save (HEATMAP_SNAPSHOT_DIR, ids[i], now, canvas))
+      g_printerr ("Failed to save heatmap snapshot of source %u\n", ids[i]);
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+/* Renders every source's overlay into its time-lapse. Runs on the main loop;
+ * the streaming thread only waits for the canvas copy, and encoding happens
+ * on the exporter's own thread. Idle sources are not rendered again. */
+static gboolean
+add_timelapse_frames (gpointer data)
+{
+  static cv::Mat canvas, background;
+  static HeatmapRenderWorkspace workspace;
+  static const cv::Mat unchanged;
+  HeatmapRenderParams params;
+  params.mode = HEATMAP_RENDER_OVERLAY;
+  params.colormap = cv::COLORMAP_JET;
+  params.alpha = 0.75;
+  params.window = cv::Rect ();
+
+  unsigned int ids[HEATMAP_MAX_SOURCES];
+  unsigned int n = heatmap_engine_list_sources (ids, HEATMAP_MAX_SOURCES);
+  for (unsigned int i = 0; i < n; i++) {
+    unsigned int id = ids[i];
+    if (!timelapses[id] && !timelapse_failed[id]) {
+      gchar *path = g_strdup_printf ("%s/%u.avi", timelapse_dir, id);
+      HeatmapTimelapseParams tl_params;
+      heatmap_timelapse_default_params (&tl_params, path,
+          heatmap_engine_width (), heatmap_engine_height ());
+      timelapses[id] = heatmap_timelapse_open (&tl_params);
+      timelapse_failed[id] = !timelapses[id];
+      g_free (path);
+    }
+    if (!timelapses[id])
+      continue;
+    HeatmapSource *src = heatmap_engine_find_source (id);
+    uint64_t version = heatmap_source_version (src, HEATMAP_RENDER_OVERLAY);
+    if (version && version == timelapse_versions[id]) {
+      heatmap_timelapse_submit (timelapses[id], unchanged, version);
+      continue;
+    }
+    version = heatmap_source_snapshot (src, HEATMAP_RENDER_OVERLAY, canvas,
+        &background);
+    if (heatmap_timelapse_submit (timelapses[id],
+            heatmap_render (canvas, background, params, &workspace), version))
+      timelapse_versions[id] = version;
+    else
+      timelapse_versions[id] = 0;
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+/* Writes what the streaming thread queued for the detection log. */
+static gboolean
+flush_detections_log (gpointer data)
+{
+  if (!heatmap_recorder_flush (detections_log))
+    g_printerr ("Failed to write the detection log\n");
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+close_timelapses (void)
+{
+  for (unsigned int id = 0; id < HEATMAP_MAX_SOURCES; id++) {
+    if (!timelapses[id])
+      continue;
+    HeatmapTimelapseStats stats;
+    heatmap_timelapse_close (timelapses[id], &stats);
+    timelapses[id] = NULL;
+    g_print ("Time-lapse of source %u: %" G_GUINT64_FORMAT " frames, %"
+        G_GUINT64_FORMAT " repeated, %" G_GUINT64_FORMAT " dropped\n", id,
+        stats.encoded + stats.repeated, stats.repeated, stats.dropped);
+  }
+}
+
+/* Resumes every source that has snapshots from its latest one, so the
+ * cumulative snapshots stay monotonic across restarts. */
+static void
+restore_snapshots (void)
+{
+  std::vector<unsigned int> ids;
+  std::vector<HeatmapSnapshotInfo> snapshots;
+  heatmap_snapshot_sources (HEATMAP_SNAPSHOT_DIR, ids);
+  for (unsigned int id : ids) {
+    HeatmapSource *src = heatmap_engine_get_source (id);
+    heatmap_snapshot_list (HEATMAP_SNAPSHOT_DIR, id, snapshots);
+    cv::Mat canvas;
+    if (!src || snapshots.empty () ||
+        !heatmap_snapshot_load (snapshots.back ().path.c_str (), canvas))
+      continue;
+    if (heatmap_source_restore (src, canvas))
+      g_print ("Resumed source %u from %s\n", id,
+          snapshots.back ().path.c_str ());
+    else
+      g_printerr ("Snapshot %s does not match the canvas size, ignored\n",
+          snapshots.back ().path.c_str ());
+  }
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -645,6 +855,49 @@ main (int argc, char *argv[])
     return -1;
   }
 
+  /* Allocate everything the streaming thread needs for the input up front, so
+   * steady-state frames do not go through the allocator. */
+  HeatmapConfig heatmap_config;
+  heatmap_config_default (&heatmap_config);
+  if (g_file_test (HEATMAP_CONFIG_FILE, G_FILE_TEST_EXISTS) &&
+      !heatmap_config_load (HEATMAP_CONFIG_FILE, &heatmap_config)) {
+    g_printerr ("Failed to load %s. Exiting.\n", HEATMAP_CONFIG_FILE);
+    return -1;
+  }
+  if (!heatmap_engine_init_geometry (&heatmap_config.geometry)) {
+    g_printerr ("Invalid geometry in %s. Exiting.\n", HEATMAP_CONFIG_FILE);
+    return -1;
+  }
+  g_print ("Heatmap %dx%d, kernels %s\n", heatmap_engine_width (),
+      heatmap_engine_height (), heatmap_engine_kernel_name ());
+  heatmap_engine_set_weighting (&heatmap_config.weighting);
+  snapshots_enabled =
+      heatmap_config.geometry.accumulator != HEATMAP_ACCUMULATOR_UINT16;
+  if (snapshots_enabled)
+    restore_snapshots ();
+  else
+    g_print ("Not writing snapshots: the uint16 accumulator saturates, set "
+        "accumulator=int32 in %s to compare periods\n", HEATMAP_CONFIG_FILE);
+  occupancy_init (OCCUPANCY_DEFAULT_INTERVAL_SEC, OCCUPANCY_DEFAULT_INTERVALS);
+  if (!add_source (INPUT_SOURCE_ID, current_device)) {
+    g_printerr ("Failed to allocate source workspace. Exiting.\n");
+    return -1;
+  }
+  frame_dets.reserve (MAX_DETECTIONS_PER_FRAME);
+
+  const gchar *record_path = g_getenv ("FOOTFALL_RECORD_DETECTIONS");
+  if (record_path) {
+    detections_log = heatmap_recorder_open (record_path,
+        DETECTIONS_LOG_FRAMES, DETECTIONS_LOG_DETECTIONS);
+    if (!detections_log)
+      g_printerr ("Failed to open %s for recording detections\n", record_path);
+  }
+  timelapse_dir = g_getenv ("FOOTFALL_TIMELAPSE_DIR");
+  if (timelapse_dir && g_mkdir_with_parents (timelapse_dir, 0755) != 0) {
+    g_printerr ("Failed to create %s, time-lapse disabled\n", timelapse_dir);
+    timelapse_dir = NULL;
+  }
+
   /* Standard GStreamer initialization */
   gst_init (&argc, &argv);
   loop = g_main_loop_new (NULL, FALSE);
@@ -681,7 +934,7 @@ main (int argc, char *argv[])
 
    gst_bin_add (GST_BIN (pipeline), source_bin);
 
-    g_snprintf (pad_name, 15, "sink_%u", 1);
+    g_snprintf (pad_name, 15, "sink_%u", INPUT_SOURCE_ID);
     sinkpad = gst_element_get_request_pad (streammux, pad_name);
 
 
@@ -731,8 +984,10 @@ if (!sinkpad) {
   }
     g_object_set (G_OBJECT (streammux), "batch-size", 1, NULL);
 
-    g_object_set (G_OBJECT (streammux), "width", MUXER_OUTPUT_WIDTH, "height",
-        MUXER_OUTPUT_HEIGHT,
+    /* The muxer scales every input to the heatmap canvas size, the
+     * [geometry] width and height of HEATMAP_CONFIG_FILE. */
+    g_object_set (G_OBJECT (streammux), "width", heatmap_engine_width (),
+        "height", heatmap_engine_height (),
         "batched-push-timeout", MUXER_BATCH_TIMEOUT_USEC, NULL);
     g_object_set (G_OBJECT (pgie),
         "config-file-path", "dstest1_pgie_config.txt", NULL);
@@ -810,6 +1065,23 @@ if (!sinkpad) {
 
 
 
+  if (heatmap_server_start (HEATMAP_SERVER_ADDR,
+          HEATMAP_SERVER_DEFAULT_PORT) < 0)
+    g_printerr ("Failed to start heatmap server, continuing without it\n");
+  else
+    g_print ("Serving heatmaps on http://%s:%d/\n", HEATMAP_SERVER_ADDR,
+        HEATMAP_SERVER_DEFAULT_PORT);
+
+  if (snapshots_enabled)
+    g_timeout_add_seconds (HEATMAP_SNAPSHOT_INTERVAL_SEC, save_snapshots,
+        NULL);
+  if (timelapse_dir)
+    g_timeout_add_seconds (HEATMAP_TIMELAPSE_INTERVAL_SEC,
+        add_timelapse_frames, NULL);
+  if (detections_log)
+    g_timeout_add_seconds (DETECTIONS_LOG_FLUSH_SEC, flush_detections_log,
+        NULL);
+
   /* Set the pipeline to "playing" state */
   g_print ("Using file: %s\n", argv[1]);
   GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN (pipeline), GST_DEBUG_GRAPH_SHOW_ALL, "pipeline");
@@ -821,6 +1093,23 @@ if (!sinkpad) {
   /* Out of the main loop, clean up nicely */
   g_print ("Returned, stopping playback\n");
   gst_element_set_state (pipeline, GST_STATE_NULL);
+  heatmap_server_stop ();
+  if (snapshots_enabled)
+    save_snapshots (NULL);
+  close_timelapses ();
+  for (guint id = 0; id < HEATMAP_MAX_SOURCES; id++)
+    source_workspace_destroy (id);
+  if (detections_log) {
+    guint64 dropped = 0;
+    if (!heatmap_recorder_close (detections_log, &dropped))
+      g_printerr ("Failed to write the detection log\n");
+    if (dropped)
+      g_printerr ("%" G_GUINT64_FORMAT " frames did not fit the detection "
+          "log buffer and were not recorded\n", dropped);
+  }
+  if (capped_detections)
+    g_printerr ("%" G_GUINT64_FORMAT " detections over %d per frame were "
+        "ignored\n", capped_detections, MAX_DETECTIONS_PER_FRAME);
   g_print ("Deleting pipeline\n");
   gst_object_unref (GST_OBJECT (pipeline));
   g_source_remove (bus_watch_id);
@@ -0,0 +1,259 @@
+/*
+ * Compares the heatmaps of two periods, e.g. this week against last week.
+ *
+ * Periods are read from the snapshot directory the app writes (see
+ * heatmap_snapshot.h) and given as FROM..TO, each end either Unix seconds
+ * or a local YYYY-MM-DD[THH:MM]. Period ends snap back to the latest
+ * snapshot at or before them. Two snapshot files can be compared directly
+ * instead. Prints the top changed regions of every source as JSON and, with
+ * -o, writes diff-<source>.png and ratio-<source>.png.
+ *
+ * The stamp weight the snapshots were accumulated with, which -a needs to
+ * report detections, is read from the [geometry] section of the app's
+ * config file, heatmap_config.txt if it exists.
+ *
+ * Usage: heatmap_compare [-c config] [-d snapshots] [-s all|N[,N...]]
+ *                        [-k regions] [-t threshold] [-m min_area] [-a]
+ *                        [-o outdir] A B
+ *
+ *   heatmap_compare 2024-03-04..2024-03-11 2024-03-11..2024-03-18
+ *   heatmap_compare snapshots/0/1710115200.tiff snapshots/0/1710720000.tiff
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../heatmap_compare.h"
+#include "../heatmap_config.h"
+#include "../heatmap_snapshot.h"
+#include "opencv2/highgui/highgui.hpp"
+
+using namespace std;
+
+#define CONFIG_FILE "heatmap_config.txt"
+
+struct Job {
+  unsigned int source_id;
+  bool ok;
+  HeatmapComparison result;
+};
+
+static bool
+parse_time (const char *s, int64_t *time)
+{
+  struct tm tm;
+  memset (&tm, 0, sizeof (tm));
+  const char *end = strptime (s, "%Y-%m-%dT%H:%M", &tm);
+  if (!end) {
+    memset (&tm, 0, sizeof (tm));
+    end = strptime (s, "%Y-%m-%d", &tm);
+  }
+  if (end && *end == '\0') {
+    tm.tm_isdst = -1;
+    *time = mktime (&tm);
+    return true;
+  }
+  char *num_end;
+  long long value = strtoll (s, &num_end, 10);
+  if (num_end == s || *num_end)
+    return false;
+  *time = value;
+  return true;
+}
+
+static bool
+parse_period (const char *s, int64_t *from, int64_t *to)
+{
+  const char *dots = strstr (s, "..");
+  if (!dots)
+    return false;
+  string first (s, dots - s);
+  return parse_time (first.c_str (), from) && parse_time (dots + 2, to) &&
+      *from < *to;
+}
+
+static bool
+parse_sources (const char *s, vector<unsigned int> &ids)
+{
+  ids.clear ();
+  if (strcmp (s, "all") == 0)
+    return true;
+  while (*s) {
+    char *end;
+    long id = strtol (s, &end, 10);
+    if (end == s || id < 0 || (*end && *end != ','))
+      return false;
+    ids.push_back ((unsigned int) id);
+    s = *end ? end + 1 : end;
+  }
+  return !ids.empty ();
+}
+
+static void
+print_result (const Job &job, bool last)
+{
+  const HeatmapComparison &r = job.result;
+  printf ("    {\"source\": %u, \"diff_min\": %.3f, \"diff_max\": %.3f, "
+      "\"regions\": [", job.source_id, r.diff_min, r.diff_max);
+  for (size_t i = 0; i < r.regions.size (); i++) {
+    const HeatmapRegion &g = r.regions[i];
+    printf ("%s\n      {\"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d, "
+        "\"area\": %d, \"change\": %.2f, \"peak\": %.3f, \"peak_x\": %d, "
+        "\"peak_y\": %d}", i ? "," : "", g.box.x, g.box.y, g.box.width,
+        g.box.height, g.area, g.change, g.peak, g.peak_at.x, g.peak_at.y);
+  }
+  printf ("%s]}%s\n", r.regions.empty () ? "" : "\n    ", last ? "" : ",");
+}
+
+static void
+usage (const char *name)
+{
+  fprintf (stderr, "Usage: %s [-c config] [-d snapshots] [-s all|N[,N...]] "
+      "[-k regions] [-t threshold] [-m min_area] [-a] [-o outdir] A B\n"
+      "  A, B: FROM..TO periods (Unix seconds or YYYY-MM-DD[THH:MM]) or two "
+      "snapshot files\n", name);
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *config_path = NULL;
+  const char *dir = "snapshots";
+  const char *sources = "all";
+  const char *outdir = NULL;
+  HeatmapCompareParams params;
+  heatmap_compare_default_params (&params);
+  int opt;
+  while ((opt = getopt (argc, argv, "c:d:s:k:t:m:ao:")) != -1) {
+    switch (opt) {
+      case 'c':
+        config_path = optarg;
+        break;
+      case 'd':
+        dir = optarg;
+        break;
+      case 's':
+        sources = optarg;
+        break;
+      case 'k':
+        params.top_k = atoi (optarg);
+        break;
+      case 't':
+        params.threshold = (float) atof (optarg);
+        break;
+      case 'm':
+        params.min_area = atoi (optarg);
+        break;
+      case 'a':
+        params.normalize = false;
+        break;
+      case 'o':
+        outdir = optarg;
+        break;
+      default:
+        usage (argv[0]);
+        return -1;
+    }
+  }
+  if (argc - optind != 2) {
+    usage (argv[0]);
+    return -1;
+  }
+  const char *arg_a = argv[optind], *arg_b = argv[optind + 1];
+
+  HeatmapConfig config;
+  heatmap_config_default (&config);
+  if (!config_path && access (CONFIG_FILE, R_OK) == 0)
+    config_path = CONFIG_FILE;
+  if (config_path && !heatmap_config_load (config_path, &config))
+    return -1;
+  params.stamp_weight = config.geometry.stamp_weight;
+
+  vector<Job> jobs;
+  int64_t a_from, a_to, b_from, b_to;
+  bool periods = parse_period (arg_a, &a_from, &a_to);
+  if (periods != parse_period (arg_b, &b_from, &b_to)) {
+    fprintf (stderr, "compare two periods or two snapshot files\n");
+    return -1;
+  }
+
+  if (!periods) {
+    cv::Mat a, b;
+    jobs.resize (1);
+    jobs[0].source_id = 0;
+    if (!heatmap_snapshot_load (arg_a, a) ||
+        !heatmap_snapshot_load (arg_b, b) ||
+        !heatmap_compare (a, b, params, &jobs[0].result)) {
+      fprintf (stderr, "cannot compare %s and %s\n", arg_a, arg_b);
+      return -1;
+    }
+    jobs[0].ok = true;
+  } else {
+    vector<unsigned int> ids;
+    if (!parse_sources (sources, ids)) {
+      fprintf (stderr, "invalid source list %s\n", sources);
+      return -1;
+    }
+    if (ids.empty ())
+      heatmap_snapshot_sources (dir, ids);
+    jobs.resize (ids.size ());
+    for (size_t i = 0; i < ids.size (); i++)
+      jobs[i].source_id = ids[i];
+
+    /* Sources are independent; most of the time goes into decoding the
+     * snapshots, so spread them over the cores. */
+    atomic<size_t> next (0);
+    unsigned int n = std::max (1u, std::min (thread::hardware_concurrency (),
+            (unsigned int) jobs.size ()));
+    vector<thread> workers;
+    for (unsigned int t = 0; t < n; t++)
+      workers.emplace_back ([&] {
+        for (size_t i; (i = next++) < jobs.size ();)
+          jobs[i].ok = heatmap_compare_periods (dir, jobs[i].source_id,
+              a_from, a_to, b_from, b_to, params, &jobs[i].result);
+      });
+    for (thread &w : workers)
+      w.join ();
+  }
+
+  jobs.erase (std::remove_if (jobs.begin (), jobs.end (), [] (const Job &j) {
+        if (!j.ok)
+          fprintf (stderr, "source %u: no snapshots for both periods\n",
+              j.source_id);
+        return !j.ok;
+      }), jobs.end ());
+  if (jobs.empty ())
+    return 1;
+
+  printf ("{\n  \"sources\": [\n");
+  for (size_t i = 0; i < jobs.size (); i++)
+    print_result (jobs[i], i + 1 == jobs.size ());
+  printf ("  ]\n}\n");
+
+  if (outdir) {
+    cv::Mat image;
+    for (const Job &job : jobs) {
+      string base = string (outdir) + "/";
+      string id = to_string (job.source_id) + ".png";
+      heatmap_render_diff (job.result.diff, 0, image);
+      if (!cv::imwrite (base + "diff-" + id, image))
+        fprintf (stderr, "failed to write %sdiff-%s\n", base.c_str (),
+            id.c_str ());
+      heatmap_render_ratio (job.result.ratio, 4, image);
+      if (!cv::imwrite (base + "ratio-" + id, image))
+        fprintf (stderr, "failed to write %sratio-%s\n", base.c_str (),
+            id.c_str ());
+    }
+  }
+  return 0;
+}
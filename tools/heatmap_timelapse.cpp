@@ -0,0 +1,291 @@
+/*
+ * Exports a time-lapse video of one source's heatmap, offline.
+ *
+ * Frames come either from the snapshot directory the app writes (see
+ * heatmap_snapshot.h), one frame per snapshot, or from a detection log
+ * (see heatmap_replay.h) replayed through the engine, one frame every -n
+ * video frames of the log; 1800 is a minute of 30 fps video, so a day's
+ * log gives 1440 frames. Unchanged heatmaps are written as repeats without
+ * rendering or copying them again. With -b the heatmap is blended over the
+ * given background image, otherwise the colour map alone is written.
+ *
+ * Replays are weighted and stamped like the app does, per the app's config
+ * file: heatmap_config.txt if it exists, or the one given with -c. The
+ * canvas takes its [geometry] size unless -w and -h override it; from
+ * snapshots, the video takes the snapshots' size.
+ *
+ * Usage: heatmap_timelapse [-c config]
+ *                          [-d snapshots | -r detections.log [-n frames]]
+ *                          [-s source] [-w width -h height] [-b background]
+ *                          [-f fps] [-g] output
+ *   -g treats output as a GStreamer pipeline starting with appsrc.
+ *   -s defaults to 1, the app's input.
+ *
+ *   heatmap_timelapse -s 1 day.avi
+ *   heatmap_timelapse -r detections.log -n 1800 day.avi
+ *   heatmap_timelapse -g "appsrc ! videoconvert ! x264enc ! mp4mux ! \
+ *       filesink location=day.mp4"
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "../heatmap_config.h"
+#include "../heatmap_engine.h"
+#include "../heatmap_replay.h"
+#include "../heatmap_snapshot.h"
+#include "../heatmap_timelapse.h"
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+using namespace std;
+
+#define CONFIG_FILE "heatmap_config.txt"
+#define DEFAULT_STEP_FRAMES 1800
+/* The app feeds its input into streammux sink_1. */
+#define DEFAULT_SOURCE 1
+
+struct Export {
+  HeatmapTimelapse *timelapse;
+  HeatmapRenderParams params;
+  HeatmapRenderWorkspace workspace;
+  cv::Mat background;
+};
+
+static bool
+export_open (Export *ex, const char *output, bool gstreamer, double fps,
+    int width, int height, const char *background_path)
+{
+  ex->params.mode = HEATMAP_RENDER_MAP;
+  ex->params.colormap = cv::COLORMAP_JET;
+  ex->params.alpha = 0.75;
+  ex->params.window = cv::Rect ();
+  if (background_path) {
+    cv::Mat image = cv::imread (background_path, cv::IMREAD_COLOR);
+    if (image.empty ()) {
+      fprintf (stderr, "cannot read background %s\n", background_path);
+      return false;
+    }
+    cv::resize (image, ex->background, cv::Size (width, height));
+    ex->params.mode = HEATMAP_RENDER_OVERLAY;
+  }
+  heatmap_workspace_init (&ex->workspace, width, height);
+
+  /* Offline there is no pipeline to protect, so wait for the encoder
+   * rather than lose frames. */
+  HeatmapTimelapseParams params;
+  heatmap_timelapse_default_params (&params, output, width, height);
+  params.gstreamer = gstreamer;
+  params.fps = fps;
+  params.drop = HEATMAP_TIMELAPSE_BLOCK;
+  ex->timelapse = heatmap_timelapse_open (&params);
+  return ex->timelapse != NULL;
+}
+
+/* Renders canvas only if its version changed; the exporter repeats the
+ * last frame otherwise. last_version starts at UINT64_MAX. */
+static void
+export_frame (Export *ex, const cv::Mat &canvas, uint64_t version,
+    uint64_t *last_version)
+{
+  static const cv::Mat no_frame;
+  if (version == *last_version) {
+    heatmap_timelapse_submit (ex->timelapse, no_frame, version);
+    return;
+  }
+  heatmap_timelapse_submit (ex->timelapse, heatmap_render (canvas,
+          ex->background, ex->params, &ex->workspace), version);
+  *last_version = version;
+}
+
+static bool
+export_snapshots (Export *ex, const char *dir, unsigned int source_id,
+    size_t *frames)
+{
+  vector<HeatmapSnapshotInfo> snapshots;
+  heatmap_snapshot_list (dir, source_id, snapshots);
+  cv::Mat canvas, previous;
+  uint64_t version = 0, last_version = UINT64_MAX;
+  for (const HeatmapSnapshotInfo &info : snapshots) {
+    if (!heatmap_snapshot_load (info.path.c_str (), canvas)) {
+      fprintf (stderr, "skipping %s\n", info.path.c_str ());
+      continue;
+    }
+    /* Snapshots of an idle camera are identical to the one before. */
+    bool same = previous.size () == canvas.size () && previous.isContinuous ()
+        && canvas.isContinuous () && memcmp (previous.data, canvas.data,
+            canvas.total () * canvas.elemSize ()) == 0;
+    if (!same) {
+      version++;
+      canvas.copyTo (previous);
+    }
+    export_frame (ex, canvas, version, &last_version);
+    (*frames)++;
+  }
+  return *frames > 0;
+}
+
+static bool
+export_replay (Export *ex, const HeatmapReplay &replay,
+    unsigned int source_id, long step, size_t *frames)
+{
+  HeatmapSource *src = heatmap_engine_get_source (source_id);
+  cv::Mat canvas;
+  uint64_t last_version = UINT64_MAX;
+  long next = -1;
+  for (const HeatmapReplayFrame &frame : replay.frames) {
+    if (frame.source_id != source_id)
+      continue;
+    if (next < 0)
+      next = frame.frame_number + step;
+    /* One video frame per step boundary crossed, so gaps in the log show
+     * up as held frames. */
+    for (; frame.frame_number >= next; next += step) {
+      uint64_t version = heatmap_source_snapshot (src, HEATMAP_RENDER_MAP,
+          canvas, NULL);
+      export_frame (ex, canvas, version, &last_version);
+      (*frames)++;
+    }
+    heatmap_source_accumulate (src, replay.dets.data () + frame.first,
+        frame.count);
+  }
+  if (next < 0)
+    return false;
+  uint64_t version = heatmap_source_snapshot (src, HEATMAP_RENDER_MAP,
+      canvas, NULL);
+  export_frame (ex, canvas, version, &last_version);
+  (*frames)++;
+  return true;
+}
+
+static void
+usage (const char *name)
+{
+  fprintf (stderr, "Usage: %s [-c config] "
+      "[-d snapshots | -r detections.log [-n frames]] [-s source] "
+      "[-w width -h height] [-b background] [-f fps] [-g] output\n", name);
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *config_path = NULL;
+  const char *dir = "snapshots";
+  const char *log_path = NULL;
+  const char *background = NULL;
+  unsigned int source_id = DEFAULT_SOURCE;
+  int width = 0, height = 0;
+  long step = DEFAULT_STEP_FRAMES;
+  double fps = HEATMAP_TIMELAPSE_DEFAULT_FPS;
+  bool gstreamer = false;
+  int opt;
+  while ((opt = getopt (argc, argv, "c:d:r:n:s:w:h:b:f:g")) != -1) {
+    switch (opt) {
+      case 'c':
+        config_path = optarg;
+        break;
+      case 'd':
+        dir = optarg;
+        break;
+      case 'r':
+        log_path = optarg;
+        break;
+      case 'n':
+        step = atol (optarg);
+        break;
+      case 's':
+        source_id = (unsigned int) atoi (optarg);
+        break;
+      case 'w':
+        width = atoi (optarg);
+        break;
+      case 'h':
+        height = atoi (optarg);
+        break;
+      case 'b':
+        background = optarg;
+        break;
+      case 'f':
+        fps = atof (optarg);
+        break;
+      case 'g':
+        gstreamer = true;
+        break;
+      default:
+        usage (argv[0]);
+        return -1;
+    }
+  }
+  if (argc - optind != 1 || step <= 0 || width < 0 || height < 0 ||
+      !width != !height ||
+      fps <= 0 || source_id >= HEATMAP_MAX_SOURCES) {
+    usage (argv[0]);
+    return -1;
+  }
+  const char *output = argv[optind];
+
+  HeatmapConfig config;
+  heatmap_config_default (&config);
+  if (!config_path && access (CONFIG_FILE, R_OK) == 0)
+    config_path = CONFIG_FILE;
+  if (config_path && !heatmap_config_load (config_path, &config))
+    return -1;
+  HeatmapGeometry *geometry = &config.geometry;
+  if (width) {
+    geometry->width = width;
+    geometry->height = height;
+  }
+
+  HeatmapReplay replay;
+  if (log_path) {
+    if (!heatmap_replay_load (log_path, &replay))
+      return -1;
+  } else {
+    /* The video takes the size of the snapshots. */
+    vector<HeatmapSnapshotInfo> snapshots;
+    cv::Mat first;
+    heatmap_snapshot_list (dir, source_id, snapshots);
+    if (snapshots.empty () ||
+        !heatmap_snapshot_load (snapshots[0].path.c_str (), first)) {
+      fprintf (stderr, "no snapshots of source %u in %s\n", source_id, dir);
+      return 1;
+    }
+    geometry->width = first.cols;
+    geometry->height = first.rows;
+  }
+
+  if (!heatmap_engine_init_geometry (geometry))
+    return -1;
+  heatmap_engine_set_weighting (&config.weighting);
+  width = geometry->width;
+  height = geometry->height;
+  Export ex;
+  if (!export_open (&ex, output, gstreamer, fps, width, height, background))
+    return -1;
+
+  double start = (double) cv::getTickCount ();
+  size_t frames = 0;
+  bool ok = log_path ?
+      export_replay (&ex, replay, source_id, step, &frames) :
+      export_snapshots (&ex, dir, source_id, &frames);
+  /* Closing drains the queue, so the time includes all encoding. */
+  HeatmapTimelapseStats stats;
+  heatmap_timelapse_close (ex.timelapse, &stats);
+  double ms = ((double) cv::getTickCount () - start) * 1000.0 /
+      cv::getTickFrequency ();
+  if (!ok) {
+    fprintf (stderr, "nothing to export for source %u\n", source_id);
+    return 1;
+  }
+  fprintf (stderr, "%zu frames (%" PRIu64 " rendered, %" PRIu64
+      " repeated) written to %s in %.0f ms\n", frames, stats.encoded,
+      stats.repeated, output, ms);
+  return 0;
+}